@@ -0,0 +1,261 @@
+#pragma once
+#include <brpc/server.h>
+#include <bthread/bthread.h>
+#include <bthread/unstable.h>
+#include <gflags/gflags.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "logger.hpp"
+#include "instance.hpp"
+#include "etcd.hpp"
+#include "drain.hpp"
+#include "concurrency.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+// 各子服务共用的启动参数，由CHAT_DEFINE_SERVER_FLAGS在各服务的main文件中定义
+DECLARE_bool(run_mode);
+DECLARE_string(log_file);
+DECLARE_int32(log_level);
+DECLARE_string(registry_host);
+DECLARE_string(base_service);
+DECLARE_string(instance_name);
+DECLARE_string(access_host);
+DECLARE_string(zone);
+DECLARE_int32(weight);
+DECLARE_int32(capacity);
+DECLARE_string(version);
+DECLARE_int32(registry_ttl);
+DECLARE_int32(load_report_interval);
+DECLARE_int32(drain_propagate_ms);
+DECLARE_int32(drain_deadline_ms);
+DECLARE_int32(listen_port);
+DECLARE_int32(rpc_timeout);
+DECLARE_int32(rpc_threads);
+DECLARE_int32(max_concurrency);
+DECLARE_string(method_max_concurrency);
+DECLARE_bool(rpc_usercode_in_pthread);
+DECLARE_string(worker_cpus);
+DECLARE_int32(worker_numa_node);
+DECLARE_int32(blocking_threads);
+DECLARE_double(trace_sample_ratio);
+DECLARE_string(trace_file);
+
+// 在服务的main文件中使用，为共用的启动参数指定该服务的默认值
+#define CHAT_DEFINE_SERVER_FLAGS(default_instance_name, default_access_host, default_listen_port)                            \
+    DEFINE_bool(run_mode, false, "程序的运行模式，false-调试； true-发布；");                                               \
+    DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");                                                       \
+    DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");                                                          \
+    DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");                                               \
+    DEFINE_string(base_service, "/service", "服务监控根目录");                                                               \
+    DEFINE_string(instance_name, default_instance_name, "当前实例名称");                                                     \
+    DEFINE_string(access_host, default_access_host, "当前实例的外部访问地址");                                               \
+    DEFINE_string(zone, "", "当前实例所在机房/机架，用于就近路由");                                                          \
+    DEFINE_int32(weight, 100, "当前实例的路由权重");                                                                         \
+    DEFINE_int32(capacity, 0, "当前实例可承载的并发请求数，0表示不声明");                                                    \
+    DEFINE_string(version, "", "当前实例版本");                                                                              \
+    DEFINE_int32(registry_ttl, 3, "服务注册租约的有效时间(s)");                                                              \
+    DEFINE_int32(load_report_interval, 1000, "负载上报的采样间隔(ms)");                                                      \
+    DEFINE_int32(drain_propagate_ms, 2000, "下线时注销实例后等待调用方感知的时间(ms)");                                      \
+    DEFINE_int32(drain_deadline_ms, 10000, "下线时等待在途请求完成的最长时间(ms)");                                          \
+    DEFINE_int32(listen_port, default_listen_port, "Rpc服务器监听端口");                                                     \
+    DEFINE_int32(rpc_timeout, -1, "Rpc连接的空闲超时时间(s)，-1表示不超时");                                                 \
+    DEFINE_int32(rpc_threads, 0, "bthread工作线程数，0表示使用brpc默认值(cpu核数)");                                         \
+    DEFINE_int32(max_concurrency, 0, "Rpc服务器的并发上限，超出的请求立即返回ELIMIT，0表示不限制");                          \
+    DEFINE_string(method_max_concurrency, "", "各方法的并发限制，如\"auto,方法名=200\"：auto为自适应限流，数字为固定上限，不带方法名的一项对所有方法生效"); \
+    DEFINE_bool(rpc_usercode_in_pthread, false, "在pthread中执行服务代码，服务代码中有大量阻塞调用时使用");                  \
+    DEFINE_string(worker_cpus, "", "工作线程绑定的cpu列表，如\"0-7,16-23\"，为空则不绑定");                                  \
+    DEFINE_int32(worker_numa_node, -1, "工作线程绑定到该NUMA节点的全部cpu，-1表示不绑定，worker_cpus非空时忽略");            \
+    DEFINE_int32(blocking_threads, 4, "执行阻塞任务的线程池大小");                                                           \
+    DEFINE_double(trace_sample_ratio, 0.01, "链路追踪的采样比例，按request_id采样，0表示关闭");                              \
+    DEFINE_string(trace_file, "", "采样的span以json lines追加写入该文件，为空则只在rpcz中记录")
+
+namespace chat_ns
+{
+    // rpc服务器配置
+    struct RpcServerOptions
+    {
+        uint16_t port = 0;
+        int32_t idle_timeout_sec = -1;    // 连接空闲超时，-1表示不超时
+        int32_t num_threads = 0;          // bthread工作线程数，0表示使用brpc默认值
+        ConcurrencyOptions concurrency;   // 并发限制
+
+        brpc::ServerOptions toServerOptions() const
+        {
+            brpc::ServerOptions options;
+            options.idle_timeout_sec = idle_timeout_sec;
+            if (num_threads > 0)
+                options.num_threads = num_threads;
+            options.max_concurrency = concurrency.server_max_concurrency;
+            return options;
+        }
+    };
+
+    // 进程内线程配置
+    struct ThreadOptions
+    {
+        bool usercode_in_pthread = false; // 服务代码在pthread中执行，而不是bthread
+        std::vector<int> cpus;            // bthread工作线程与阻塞任务线程绑定的cpu，为空不绑定
+        int32_t blocking_threads = 4;     // 阻塞任务线程池大小
+    };
+
+    // 服务启动所需的全部配置
+    struct BootstrapOptions
+    {
+        std::string registry_host;
+        std::string base_service;
+        std::string instance_key;       // 实例在注册中心中的key
+        InstanceMeta meta;
+        int32_t registry_ttl = 3;
+        LoadReportOptions load_report;
+        DrainOptions drain;
+        RpcServerOptions rpc;
+        ThreadOptions threads;
+        TraceOptions trace;
+    };
+
+    // 解析"0-3,8,10-11"形式的cpu列表
+    inline bool parseCpuList(const std::string &list, std::vector<int> &cpus)
+    {
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty() || item == "\n")
+                continue;
+            try
+            {
+                auto pos = item.find('-');
+                int first = std::stoi(item.substr(0, pos));
+                int last = pos == std::string::npos ? first : std::stoi(item.substr(pos + 1));
+                for (int cpu = first; cpu <= last; cpu++)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("cpu列表{}格式错误：{}", list, item);
+                return false;
+            }
+        }
+        return true;
+    }
+    // 读取NUMA节点包含的cpu
+    inline bool numaNodeCpus(int32_t node, std::vector<int> &cpus)
+    {
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        std::ifstream file(path);
+        std::string list;
+        if (!file.is_open() || !std::getline(file, list))
+        {
+            LOG_ERROR("读取NUMA节点{}的cpu列表失败：{}", node, path);
+            return false;
+        }
+        return parseCpuList(list, cpus);
+    }
+
+    // 由共用启动参数生成配置，参数错误时返回false
+    inline bool bootstrapOptionsFromFlags(BootstrapOptions &options)
+    {
+        options.registry_host = FLAGS_registry_host;
+        options.base_service = FLAGS_base_service;
+        options.instance_key = FLAGS_base_service + FLAGS_instance_name;
+        options.meta = InstanceMeta(FLAGS_access_host);
+        options.meta.zone = FLAGS_zone;
+        options.meta.weight = FLAGS_weight;
+        options.meta.capacity = FLAGS_capacity;
+        options.meta.version = FLAGS_version;
+        options.registry_ttl = FLAGS_registry_ttl;
+        options.load_report.interval_ms = FLAGS_load_report_interval;
+        options.drain.propagate_ms = FLAGS_drain_propagate_ms;
+        options.drain.deadline_ms = FLAGS_drain_deadline_ms;
+
+        if (FLAGS_listen_port <= 0 || FLAGS_listen_port > 65535)
+        {
+            LOG_ERROR("监听端口{}无效", FLAGS_listen_port);
+            return false;
+        }
+        options.rpc.port = static_cast<uint16_t>(FLAGS_listen_port);
+        options.rpc.idle_timeout_sec = FLAGS_rpc_timeout;
+        options.rpc.num_threads = FLAGS_rpc_threads;
+        options.rpc.concurrency.server_max_concurrency = FLAGS_max_concurrency;
+        if (ConcurrencyOptions::parse(FLAGS_method_max_concurrency, options.rpc.concurrency) == false)
+            return false;
+
+        options.trace.service = FLAGS_instance_name;
+        options.trace.sample_ratio = FLAGS_trace_sample_ratio;
+        options.trace.export_file = FLAGS_trace_file;
+
+        options.threads.usercode_in_pthread = FLAGS_rpc_usercode_in_pthread;
+        options.threads.blocking_threads = FLAGS_blocking_threads;
+        if (!FLAGS_worker_cpus.empty())
+            return parseCpuList(FLAGS_worker_cpus, options.threads.cpus);
+        if (FLAGS_worker_numa_node >= 0)
+            return numaNodeCpus(FLAGS_worker_numa_node, options.threads.cpus);
+        return true;
+    }
+
+    // bthread工作线程启动时绑定cpu，bthread_set_worker_startfn只接受无参函数，因此借助静态变量传递
+    inline std::vector<int> &workerCpus()
+    {
+        static std::vector<int> cpus;
+        return cpus;
+    }
+    inline void bindWorkerThread()
+    {
+        bindCurrentThread(workerCpus());
+    }
+
+    // 按配置初始化进程内的线程环境，需在创建任何bthread/brpc对象之前调用
+    inline bool applyThreadOptions(const RpcServerOptions &rpc, const ThreadOptions &threads)
+    {
+        if (threads.usercode_in_pthread &&
+            google::SetCommandLineOption("usercode_in_pthread", "true").empty())
+        {
+            LOG_ERROR("设置usercode_in_pthread失败");
+            return false;
+        }
+        if (!threads.cpus.empty())
+        {
+            workerCpus() = threads.cpus;
+            if (bthread_set_worker_startfn(bindWorkerThread) != 0)
+            {
+                LOG_ERROR("设置bthread工作线程启动函数失败");
+                return false;
+            }
+            // 主线程创建的线程(etcd/日志等)继承主线程的亲和性
+            bindCurrentThread(threads.cpus);
+        }
+        if (rpc.num_threads > 0 && bthread_setconcurrency(rpc.num_threads) != 0)
+        {
+            LOG_ERROR("设置bthread工作线程数{}失败", rpc.num_threads);
+            return false;
+        }
+        return true;
+    }
+
+    // 服务进程的统一启动流程：解析命令行、初始化日志、生成配置并初始化线程环境
+    // 失败时直接退出进程，与各Builder的处理方式一致
+    inline BootstrapOptions bootstrap(int argc, char *argv[])
+    {
+        google::ParseCommandLineFlags(&argc, &argv, true);
+        logger::initLogger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+        BootstrapOptions options;
+        if (bootstrapOptionsFromFlags(options) == false)
+        {
+            LOG_ERROR("启动参数错误！");
+            abort();
+        }
+        if (applyThreadOptions(options.rpc, options.threads) == false)
+        {
+            LOG_ERROR("初始化线程环境失败！");
+            abort();
+        }
+        Tracer::instance().init(options.trace);
+        LOG_INFO("实例{}启动：监听端口{}，bthread工作线程数{}，绑定cpu数{}",
+                 options.instance_key, options.rpc.port, options.rpc.num_threads, options.threads.cpus.size());
+        return options;
+    }
+}
@@ -1,155 +1,709 @@
 #pragma once
 #include <brpc/channel.h>
+#include <brpc/retry_policy.h>
+#include <brpc/callback.h>
+#include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <butil/fast_rand.h>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <unistd.h>
 #include "logger.hpp"
+#include "instance.hpp"
+#include "trace.hpp"
 
 namespace chat_ns
 {
-    class ServiceChannel
+    // 单个下游服务的信道配置，通过ServiceManager::declared为每个关心的服务单独指定
+    struct ServiceChannelOptions
+    {
+        int32_t connect_timeout_ms = -1;
+        int32_t timeout_ms = -1;
+        int32_t max_retry = 3;
+
+        // 连接：协议与连接方式(single/pooled/short)，pooled模式下每个节点的连接池上限由brpc的--max_connection_pool_size控制
+        std::string protocol = "baidu_std";
+        std::string connection_type = "single";
+        int32_t connections_per_host = 1;             // 小请求使用的独立连接数
+        bool separate_bulk_channel = true;            // 是否为大数据量请求单独建立信道
+        std::string bulk_connection_type = "pooled";  // 大数据量请求的连接方式
+        int32_t bulk_timeout_ms = -1;                 // 大数据量请求的超时时间
+        bool prefer_unix_socket = true;               // 同机节点提供了unix域套接字时，经由该套接字访问
+
+        // 就近路由：本机器/本机房调用方流量占全部流量比例的估计值。本地节点的有效权重占比不低于该值时
+        // 本地流量全部留在本地，不足时只按比例留在本地(本地权重占比/该值)，其余溢出到其它节点
+        double locality_share = 0.2;
+        // 按实例上报的负载调整权重时，剩余容量比例的下限，避免满载节点完全得不到流量
+        double min_headroom = 0.05;
+
+        // 熔断器：统计窗口内错误率超过阈值则熔断，熔断一段时间后进入半开状态放行少量探测请求
+        int32_t breaker_window_size = 100;       // 统计窗口(调用次数)
+        int32_t breaker_min_requests = 20;       // 窗口内至少达到该调用次数才进行错误率判定
+        double breaker_error_ratio = 0.5;        // 触发熔断的错误率
+        int32_t breaker_open_ms = 5000;          // 熔断持续时间
+        int32_t breaker_half_open_probes = 5;    // 半开状态下放行的探测请求数
+
+        // 重试预算：每个请求存入ratio个令牌，每次重试消耗一个令牌，令牌数不超过上限
+        double retry_budget_ratio = 0.1;         // 重试量占总请求量的比例上限
+        int32_t retry_budget_max_tokens = 100;   // 令牌桶容量，允许的瞬时重试量
+    };
+
+    // 请求的流量类型，大数据量请求(文件上传下载等)与小请求走不同的连接
+    enum class TrafficClass
     {
+        SMALL,
+        BULK
+    };
 
+    // 服务级熔断器 closed -> open -> half-open -> closed/open
+    class CircuitBreaker
+    {
     public:
-        using ChannelPtr = std::shared_ptr<brpc::Channel>;
-        using ptr = std::shared_ptr<ServiceChannel>;
-        ServiceChannel(const std::string &name)
-            : _service_name(name),
-              _index(0) {}
-        void append(const std::string &host)
+        enum State
         {
-            auto channel = std::make_shared<brpc::Channel>();
-            brpc::ChannelOptions options;
-            options.connect_timeout_ms = -1;
-            options.timeout_ms = -1;
-            options.max_retry = 3;
-            options.protocol = "baidu_std";
-            int ret = channel->Init(host.c_str(), &options);
-            if (ret == -1)
+            CLOSED = 0,
+            OPEN = 1,
+            HALF_OPEN = 2
+        };
+        CircuitBreaker(const ServiceChannelOptions &options)
+            : _options(options),
+              _state(CLOSED),
+              _total(0),
+              _failed(0),
+              _probes(0),
+              _probe_successes(0) {}
+
+        // 判断当前是否放行请求
+        bool allow()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (_state == OPEN)
             {
-                LOG_ERROR("初始化{}-{}信道失败！", _service_name, host);
-                return;
+                if (now < _state_since + std::chrono::milliseconds(_options.breaker_open_ms))
+                    return false;
+                transit(HALF_OPEN, now);
             }
-            std::lock_guard<std::mutex> lock(_mutex);
-            _hosts.insert(std::make_pair(host, channel));
-            _channels.push_back(channel);
+            if (_state == HALF_OPEN)
+            {
+                // 探测请求长时间没有结果回报时，重新放行一轮探测，避免卡死在半开状态
+                if (now >= _state_since + std::chrono::milliseconds(_options.breaker_open_ms))
+                    transit(HALF_OPEN, now);
+                if (_probes >= _options.breaker_half_open_probes)
+                    return false;
+                _probes++;
+            }
+            return true;
         }
-        void remove(const std::string &host)
+        // 回报一次调用结果
+        void onResult(bool failed)
         {
             std::lock_guard<std::mutex> lock(_mutex);
-            auto it = _hosts.find(host);
-            if (it == _hosts.end())
+            auto now = std::chrono::steady_clock::now();
+            if (_state == HALF_OPEN)
             {
-                LOG_WARN("{}-{}节点删除信道时，未找到相关信道信息！", _service_name, host);
+                if (failed)
+                {
+                    transit(OPEN, now);
+                    return;
+                }
+                if (++_probe_successes >= _options.breaker_half_open_probes)
+                    transit(CLOSED, now);
                 return;
             }
-            for (auto vit = _channels.begin(); vit != _channels.end(); vit++)
+            if (_state == OPEN)
+                return;
+            _total++;
+            if (failed)
+                _failed++;
+            if (_total >= _options.breaker_min_requests &&
+                _failed >= _total * _options.breaker_error_ratio)
             {
-                if (*vit == it->second)
-                {
-                    _channels.erase(vit);
-                    break;
-                }
+                transit(OPEN, now);
+                return;
+            }
+            if (_total >= _options.breaker_window_size)
+            {
+                _total = 0;
+                _failed = 0;
             }
-            _hosts.erase(it);
         }
-        // 通过RR轮转，获取一个Channel用于发起对应服务的rpc调用
-        ChannelPtr choose()
+        State state()
         {
             std::lock_guard<std::mutex> lock(_mutex);
-            if (_channels.size() == 0)
+            return _state;
+        }
+
+    private:
+        void transit(State state, std::chrono::steady_clock::time_point now)
+        {
+            _state = state;
+            _state_since = now;
+            _total = 0;
+            _failed = 0;
+            _probes = 0;
+            _probe_successes = 0;
+        }
+
+    private:
+        std::mutex _mutex;
+        ServiceChannelOptions _options;
+        State _state;
+        std::chrono::steady_clock::time_point _state_since;
+        int32_t _total;           // 关闭状态下当前窗口的调用次数
+        int32_t _failed;          // 关闭状态下当前窗口的失败次数
+        int32_t _probes;          // 半开状态下已放行的探测请求数
+        int32_t _probe_successes; // 半开状态下成功的探测请求数
+    };
+
+    // 令牌桶形式的重试预算，作为brpc的RetryPolicy挂在服务的所有信道上
+    class RetryBudget : public brpc::RetryPolicy
+    {
+    public:
+        RetryBudget(const ServiceChannelOptions &options, bvar::Adder<int64_t> &shed_retries)
+            : _ratio(options.retry_budget_ratio),
+              _max_tokens(options.retry_budget_max_tokens),
+              _tokens(options.retry_budget_max_tokens),
+              _shed_retries(shed_retries) {}
+
+        // 每发起一次请求调用一次，按比例存入令牌
+        void deposit()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tokens = std::min(_max_tokens, _tokens + _ratio);
+        }
+        bool DoRetry(const brpc::Controller *cntl) const override
+        {
+            if (brpc::DefaultRetryPolicy()->DoRetry(cntl) == false)
+                return false;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_tokens < 1.0)
             {
-                LOG_ERROR("当前没有能够提供{}服务的节点！", _service_name);
-                return nullptr;
+                _shed_retries << 1;
+                return false;
             }
-            int32_t index = _index++ % _channels.size();
-            return _channels[index];
+            _tokens -= 1.0;
+            return true;
         }
 
     private:
-        std::mutex _mutex;
-        int32_t _index;                                     // 当前轮转下标计数器
-        std::string _service_name;                          // 服务名
-        std::vector<ChannelPtr> _channels;                  // 当前服务对应的信道集合
-        std::unordered_map<std::string, ChannelPtr> _hosts; // 主机地址与信道的映射关系
+        mutable std::mutex _mutex;
+        double _ratio;
+        double _max_tokens;
+        mutable double _tokens;
+        bvar::Adder<int64_t> &_shed_retries;
     };
 
-    class ServiceManager
+    // 下游调用指标：延迟分位值(p50/p99/p999)、qps、错误数与在途请求数，可在brpc内置的/vars页面查看
+    class CallStats
+    {
+    public:
+        using ptr = std::shared_ptr<CallStats>;
+        CallStats(const std::string &prefix)
+            : _latency_p50(&CallStats::latencyP50, this)
+        {
+            _latency.expose(prefix);
+            _latency_p50.expose_as(prefix, "latency_50");
+            _errors.expose_as(prefix, "error_count");
+            _inflight.expose_as(prefix, "inflight");
+        }
+        void onCallBegin()
+        {
+            _inflight << 1;
+        }
+        void onCallEnd(const brpc::Controller *cntl)
+        {
+            _inflight << -1;
+            _latency << cntl->latency_us();
+            if (cntl->Failed())
+                _errors << 1;
+        }
+
+    private:
+        static int64_t latencyP50(void *arg)
+        {
+            return static_cast<CallStats *>(arg)->_latency.latency_percentile(0.5);
+        }
+
+    private:
+        bvar::LatencyRecorder _latency;          // 延迟(us)、qps、调用次数及p80/p90/p99/p999等分位值
+        bvar::Adder<int64_t> _errors;            // 失败的调用数
+        bvar::Adder<int64_t> _inflight;          // 在途调用数
+        bvar::PassiveStatus<int64_t> _latency_p50;
+    };
+
+    // 服务级的熔断、重试预算与指标，由该服务下所有节点信道共享
+    class ServiceHealth
+    {
+    public:
+        using ptr = std::shared_ptr<ServiceHealth>;
+        ServiceHealth(const std::string &name, const ServiceChannelOptions &options)
+            : _breaker(options),
+              _budget(options, _shed_retries),
+              _breaker_state(&ServiceHealth::breakerState, this),
+              _stats("rpc_client" + name)
+        {
+            std::string prefix = "rpc_client" + name;
+            _breaker_state.expose_as(prefix, "breaker_state");
+            _shed_requests.expose_as(prefix, "shed_requests");
+            _shed_retries.expose_as(prefix, "shed_retries");
+        }
+        bool allow()
+        {
+            if (_breaker.allow())
+                return true;
+            _shed_requests << 1;
+            return false;
+        }
+        void onCallBegin()
+        {
+            _budget.deposit();
+            _stats.onCallBegin();
+        }
+        void onCallEnd(const brpc::Controller *cntl)
+        {
+            _breaker.onResult(cntl->Failed());
+            _stats.onCallEnd(cntl);
+        }
+        const brpc::RetryPolicy *retryPolicy()
+        {
+            return &_budget;
+        }
+
+    private:
+        static int breakerState(void *arg)
+        {
+            return static_cast<ServiceHealth *>(arg)->_breaker.state();
+        }
+
+    private:
+        bvar::Adder<int64_t> _shed_requests; // 熔断丢弃的请求数
+        bvar::Adder<int64_t> _shed_retries;  // 超出预算丢弃的重试数
+        CircuitBreaker _breaker;
+        RetryBudget _budget;
+        bvar::PassiveStatus<int> _breaker_state;
+        CallStats _stats; // 服务维度的调用指标
+    };
+
+    // 节点信道：在brpc::Channel基础上，将每次调用的结果回报给所属服务，并记录服务与节点维度的调用指标
+    class NodeChannel : public brpc::Channel
+    {
+    public:
+        NodeChannel(const ServiceHealth::ptr &health, const CallStats::ptr &host_stats)
+            : _health(health), _host_stats(host_stats) {}
+        void CallMethod(const google::protobuf::MethodDescriptor *method,
+                        google::protobuf::RpcController *controller,
+                        const google::protobuf::Message *request,
+                        google::protobuf::Message *response,
+                        google::protobuf::Closure *done) override
+        {
+            brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+            _health->onCallBegin();
+            _host_stats->onCallBegin();
+            if (done == nullptr)
+            {
+                ScopedSpan span("rpc_client", method->full_name());
+                brpc::Channel::CallMethod(method, controller, request, response, nullptr);
+                if (cntl->Failed())
+                    span.fail();
+                _health->onCallEnd(cntl);
+                _host_stats->onCallEnd(cntl);
+                return;
+            }
+            auto span = std::make_unique<ScopedSpan>("rpc_client", method->full_name(), false);
+            brpc::Channel::CallMethod(method, controller, request, response,
+                                      new ReportClosure(_health, _host_stats, cntl, done, std::move(span)));
+        }
+
+    private:
+        class ReportClosure : public google::protobuf::Closure
+        {
+        public:
+            ReportClosure(const ServiceHealth::ptr &health,
+                          const CallStats::ptr &host_stats,
+                          brpc::Controller *cntl,
+                          google::protobuf::Closure *done,
+                          std::unique_ptr<ScopedSpan> span)
+                : _health(health), _host_stats(host_stats), _cntl(cntl), _done(done), _span(std::move(span)) {}
+            void Run() override
+            {
+                std::unique_ptr<ReportClosure> self_guard(this);
+                if (_cntl->Failed())
+                    _span->fail();
+                _span->end();
+                _health->onCallEnd(_cntl);
+                _host_stats->onCallEnd(_cntl);
+                _done->Run();
+            }
+
+        private:
+            ServiceHealth::ptr _health;
+            CallStats::ptr _host_stats;
+            brpc::Controller *_cntl;
+            google::protobuf::Closure *_done;
+            std::unique_ptr<ScopedSpan> _span;
+        };
+
+    private:
+        ServiceHealth::ptr _health;
+        CallStats::ptr _host_stats;
+    };
+
+    class ServiceChannel
     {
 
     public:
-        using ptr = std::shared_ptr<ServiceManager>;
         using ChannelPtr = std::shared_ptr<brpc::Channel>;
-        ChannelPtr choose(const std::string &service_name)
+        using ptr = std::shared_ptr<ServiceChannel>;
+        ServiceChannel(const std::string &name,
+                       const ServiceChannelOptions &options = ServiceChannelOptions(),
+                       const Locality &locality = Locality())
+            : _service_name(name),
+              _options(options),
+              _locality(locality),
+              _health(std::make_shared<ServiceHealth>(name, options)),
+              _table(std::make_shared<RouteTable>()) {}
+        // 批量更新节点：新信道在锁外初始化，完成后一次性替换路由表
+        void update(const std::vector<InstanceMeta> &online, const std::vector<std::string> &offline)
+        {
+            std::lock_guard<std::mutex> update_lock(_update_mutex);
+            std::shared_ptr<const RouteTable> current;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                current = _table;
+            }
+            auto table = std::make_shared<RouteTable>();
+            table->hosts = current->hosts;
+            for (auto &host : offline)
+            {
+                if (table->hosts.erase(host) == 0)
+                    LOG_WARN("{}-{}节点删除信道时，未找到相关信道信息！", _service_name, host);
+            }
+            for (auto &meta : online)
+            {
+                auto it = table->hosts.find(meta.host);
+                if (it != table->hosts.end() && sameEndpoint(it->second->meta, meta))
+                {
+                    // 已存在的节点只有权重、负载等变化时，更新注册信息并复用原有信道
+                    auto node = std::make_shared<NodeChannels>(*it->second);
+                    node->meta = meta;
+                    it->second = node;
+                    continue;
+                }
+                auto node = makeNode(meta);
+                if (node)
+                    table->hosts[meta.host] = node;
+            }
+            for (auto &[host, node] : table->hosts)
+            {
+                table->nodes.push_back(node);
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _table = table;
+        }
+        // 按就近原则与权重选择一个节点，获取其Channel用于发起对应服务的rpc调用；服务处于熔断状态时返回空
+        ChannelPtr choose(TrafficClass traffic = TrafficClass::SMALL)
         {
+            if (_health->allow() == false)
+            {
+                LOG_WARN("{}服务处于熔断状态，请求被丢弃！", _service_name);
+                return nullptr;
+            }
             std::lock_guard<std::mutex> lock(_mutex);
-            auto sit = _services.find(service_name);
-            if (sit == _services.end())
+            if (_table->nodes.size() == 0)
             {
-                LOG_ERROR("当前没有能够提供{}服务的节点！", service_name);
+                LOG_ERROR("当前没有能够提供{}服务的节点！", _service_name);
                 return nullptr;
             }
-            return sit->second->choose();
+            auto node = pickNode();
+            if (traffic == TrafficClass::BULK && node->bulk)
+                return node->bulk;
+            return node->small[node->picks++ % node->small.size()];
         }
-        void declared(const std::string &service_name)
+
+    private:
+        // 单个节点的信道集合
+        struct NodeChannels
         {
-            std::lock_guard<std::mutex> lock(_mutex);
-            _follow_services.insert(service_name);
+            InstanceMeta meta;             // 节点注册信息
+            int64_t current_weight = 0;    // 平滑加权轮询的当前权重
+            uint32_t picks = 0;            // 节点内小请求信道的轮转计数
+            CallStats::ptr stats;          // 节点维度的调用指标
+            std::vector<ChannelPtr> small; // 小请求信道，多个独立连接
+            ChannelPtr bulk;               // 大数据量请求信道
+        };
+        using NodePtr = std::shared_ptr<NodeChannels>;
+        // 路由表，生成后不再修改，整体替换
+        struct RouteTable
+        {
+            std::vector<NodePtr> nodes;                      // 当前服务对应的节点信道集合
+            std::unordered_map<std::string, NodePtr> hosts;  // 主机地址与节点信道的映射关系
+        };
+
+        // 信道的连接地址取决于unix域套接字路径与所在机器，两者变化时需要重建信道
+        static bool sameEndpoint(const InstanceMeta &old_meta, const InstanceMeta &new_meta)
+        {
+            return old_meta.unix_path == new_meta.unix_path && old_meta.machine == new_meta.machine;
         }
-        void onServiceOnline(const std::string &service_instance, const std::string &host)
+        NodePtr makeNode(const InstanceMeta &meta)
         {
-            std::string service_name = getServiceName(service_instance);
-            ServiceChannel::ptr service;
+            auto node = std::make_shared<NodeChannels>();
+            node->meta = meta;
+            node->stats = hostStats(meta.host);
+            // 小请求信道：每个连接使用独立的连接分组，从而得到互不干扰的多个socket
+            int32_t sockets = std::max(1, _options.connections_per_host);
+            for (int32_t i = 0; i < sockets; i++)
             {
-                std::lock_guard<std::mutex> lock(_mutex);
-                auto fit = _follow_services.find(service_name);
-                if (fit == _follow_services.end())
-                {
-                    LOG_DEBUG("{}-{}服务已上线(未关心)", service_name, host);
-                    return;
-                }
-                auto sit = _services.find(service_name);
-                if (sit == _services.end())
-                {
-                    service = std::make_shared<ServiceChannel>(service_name);
-                    _services.insert(std::make_pair(service_name, service));
-                }
-                else
-                {
-                    service = sit->second;
-                }
+                auto channel = makeChannel(node, _options.connection_type, "small-" + std::to_string(i), _options.timeout_ms);
+                if (!channel)
+                    return nullptr;
+                node->small.push_back(channel);
             }
-            if (!service)
+            // 大数据量请求信道：与小请求使用不同的连接，避免大文件传输阻塞小请求
+            if (_options.separate_bulk_channel)
             {
-                LOG_ERROR("新增{}服务管理节点失败！", service_name);
-                return;
+                node->bulk = makeChannel(node, _options.bulk_connection_type, "bulk", _options.bulk_timeout_ms);
+                if (!node->bulk)
+                    return nullptr;
             }
-            service->append(host);
-            LOG_INFO("{}-{}服务已上线，已添加至管理", service_name, host);
+            return node;
         }
-        void onServiceOffline(const std::string &service_instance, const std::string &host)
+
+        // 节点维度的指标按主机地址保存在服务信道中，节点下线后重新上线时沿用，
+        // 避免旧节点仍被在途调用持有时，新节点以相同的名字暴露bvar失败；调用方持有_update_mutex
+        CallStats::ptr hostStats(const std::string &host)
+        {
+            auto it = _host_stats.find(host);
+            if (it != _host_stats.end())
+                return it->second;
+            auto stats = std::make_shared<CallStats>("rpc_client" + _service_name + "_" + host);
+            _host_stats.emplace(host, stats);
+            return stats;
+        }
+
+        // 依次尝试同机器、同机房的节点：本地节点按其有效权重(已按剩余容量折算)能承载的比例接收流量，
+        // 其余按比例溢出到更远的节点；本地节点负载升高时留在本地的比例随之平滑下降，不会整体来回切换
+        NodePtr pickNode()
+        {
+            int64_t total = 0;
+            int64_t same_machine = 0;
+            int64_t same_zone = 0;
+            for (auto &node : _table->nodes)
+            {
+                int64_t w = nodeWeight(node);
+                total += w;
+                if (isSameMachine(node))
+                    same_machine += w;
+                if (isSameZone(node))
+                    same_zone += w;
+            }
+            double target = total * _options.locality_share;
+            auto keep = [target](int64_t local) -> double
+            {
+                if (local == 0)
+                    return 0;
+                return target <= 0 ? 1.0 : std::min(1.0, local / target);
+            };
+            // 同一个随机数依次与两级比例比较，同机器溢出的流量优先落到同机房的其它节点
+            double keep_machine = keep(same_machine);
+            double keep_zone = std::max(keep_machine, keep(same_zone));
+            double r = butil::fast_rand_double();
+            NodePtr picked;
+            if (r < keep_machine)
+                picked = weightedPick([this](const NodePtr &node)
+                                    { return isSameMachine(node); });
+            else if (r < keep_zone)
+                picked = weightedPick([this](const NodePtr &node)
+                                    { return isSameZone(node) && !isSameMachine(node); });
+            else
+                picked = weightedPick([this](const NodePtr &node)
+                                    { return !isSameZone(node) && !isSameMachine(node); });
+            if (!picked)
+                picked = weightedPick([](const NodePtr &) { return true; });
+            return picked;
+        }
+        bool isSameMachine(const NodePtr &node) const
+        {
+            return !_locality.machine.empty() && node->meta.machine == _locality.machine;
+        }
+        bool isSameZone(const NodePtr &node) const
+        {
+            return !_locality.zone.empty() && node->meta.zone == _locality.zone;
+        }
+        // 平滑加权轮询
+        NodePtr weightedPick(const std::function<bool(const NodePtr &)> &filter)
+        {
+            NodePtr best;
+            int64_t total = 0;
+            for (auto &node : _table->nodes)
+            {
+                if (filter(node) == false)
+                    continue;
+                int64_t w = nodeWeight(node);
+                node->current_weight += w;
+                total += w;
+                if (!best || node->current_weight > best->current_weight)
+                    best = node;
+            }
+            if (!best)
+                return nullptr;
+            best->current_weight -= total;
+            return best;
+        }
+        // 有效权重 = 声明的权重 * 剩余容量比例，剩余容量取并发余量与cpu余量中较小者
+        int64_t nodeWeight(const NodePtr &node)
+        {
+            const InstanceMeta &meta = node->meta;
+            double headroom = 1.0 - meta.load.cpu;
+            if (meta.capacity > 0)
+                headroom = std::min(headroom, 1.0 - (double)meta.load.inflight / meta.capacity);
+            headroom = std::max(_options.min_headroom, std::min(1.0, headroom));
+            return std::max<int64_t>(1, static_cast<int64_t>(meta.weight * headroom));
+        }
+        ChannelPtr makeChannel(const NodePtr &node,
+                               const std::string &connection_type,
+                               const std::string &connection_group,
+                               int32_t timeout_ms)
+        {
+            const std::string &host = node->meta.host;
+            std::string endpoint = localEndpoint(node->meta);
+            if (endpoint.empty())
+                endpoint = host;
+            auto channel = std::make_shared<NodeChannel>(_health, node->stats);
+            brpc::ChannelOptions options;
+            options.connect_timeout_ms = _options.connect_timeout_ms;
+            options.timeout_ms = timeout_ms;
+            options.max_retry = _options.max_retry;
+            options.retry_policy = _health->retryPolicy();
+            options.protocol = _options.protocol;
+            options.connection_type = connection_type;
+            options.connection_group = connection_group;
+            int ret = channel->Init(endpoint.c_str(), &options);
+            if (ret == -1)
+            {
+                LOG_ERROR("初始化{}-{}信道失败({}/{})！", _service_name, endpoint, connection_type, connection_group);
+                return nullptr;
+            }
+            return channel;
+        }
+        // 与当前进程同机且提供了unix域套接字的节点，返回"unix:路径"，绕过tcp回环；否则返回空
+        std::string localEndpoint(const InstanceMeta &meta)
+        {
+            if (_options.prefer_unix_socket == false || meta.unix_path.empty())
+                return std::string();
+            if (_locality.machine.empty() || meta.machine != _locality.machine)
+                return std::string();
+            if (access(meta.unix_path.c_str(), F_OK) != 0)
+            {
+                LOG_WARN("{}-{}的unix域套接字{}不可访问，使用tcp连接", _service_name, meta.host, meta.unix_path);
+                return std::string();
+            }
+            LOG_INFO("{}-{}与当前进程同机，经由unix域套接字{}访问", _service_name, meta.host, meta.unix_path);
+            return "unix:" + meta.unix_path;
+        }
+
+    private:
+        std::mutex _mutex;                                  // 保护路由表指针与轮询状态
+        std::mutex _update_mutex;                           // 串行化路由表更新
+        std::string _service_name;                          // 服务名
+        ServiceChannelOptions _options;                     // 信道配置
+        Locality _locality;                                 // 当前进程所处位置
+        ServiceHealth::ptr _health;                         // 熔断器、重试预算与指标
+        std::shared_ptr<const RouteTable> _table;           // 当前路由表
+        std::unordered_map<std::string, CallStats::ptr> _host_stats; // 各主机的调用指标，受_update_mutex保护
+    };
+
+    class ServiceManager
+    {
+
+    public:
+        using ptr = std::shared_ptr<ServiceManager>;
+        using ChannelPtr = std::shared_ptr<brpc::Channel>;
+        ChannelPtr choose(const std::string &service_name, TrafficClass traffic = TrafficClass::SMALL)
         {
-            std::string service_name = getServiceName(service_instance);
             ServiceChannel::ptr service;
             {
                 std::lock_guard<std::mutex> lock(_mutex);
-                auto fit = _follow_services.find(service_name);
-                if (fit == _follow_services.end())
-                {
-                    LOG_DEBUG("{}-{}服务已下线(未关心)", service_name, host);
-                    return;
-                }
                 auto sit = _services.find(service_name);
                 if (sit == _services.end())
                 {
-                    LOG_WARN("删除{}服务管理节点时，找不到管理对象！", service_name);
-                    return;
+                    LOG_ERROR("当前没有能够提供{}服务的节点！", service_name);
+                    return nullptr;
                 }
                 service = sit->second;
             }
-            service->remove(host);
-            LOG_INFO("{}-{}服务已下线，已在管理中删除", service_name, host);
+            return service->choose(traffic);
+        }
+        // 设置当前进程所处位置，需在服务上线前调用
+        void setLocality(const Locality &locality)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _locality = locality;
+        }
+        void declared(const std::string &service_name,
+                      const ServiceChannelOptions &options = ServiceChannelOptions())
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _follow_services[service_name] = options;
+        }
+        void onServiceOnline(const std::string &service_instance, const std::string &value)
+        {
+            onServiceBatch({ServiceEvent{ServiceEvent::PUT, service_instance, value}});
+        }
+        void onServiceOffline(const std::string &service_instance, const std::string &value)
+        {
+            onServiceBatch({ServiceEvent{ServiceEvent::DEL, service_instance, value}});
+        }
+        // 批量应用服务上下线事件，每个服务的路由表只替换一次
+        void onServiceBatch(const std::vector<ServiceEvent> &events)
+        {
+            std::unordered_map<std::string, std::pair<std::vector<InstanceMeta>, std::vector<std::string>>> changes;
+            for (auto &ev : events)
+            {
+                std::string service_name = getServiceName(ev.key);
+                InstanceMeta meta = InstanceMeta::parse(ev.value);
+                if (ev.type == ServiceEvent::PUT)
+                    changes[service_name].first.push_back(meta);
+                else
+                    changes[service_name].second.push_back(meta.host);
+            }
+            for (auto &[service_name, change] : changes)
+            {
+                ServiceChannel::ptr service;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    auto fit = _follow_services.find(service_name);
+                    if (fit == _follow_services.end())
+                    {
+                        LOG_DEBUG("{}服务节点变更(未关心)：上线{}个，下线{}个", service_name, change.first.size(), change.second.size());
+                        continue;
+                    }
+                    auto sit = _services.find(service_name);
+                    if (sit == _services.end())
+                    {
+                        service = std::make_shared<ServiceChannel>(service_name, fit->second, _locality);
+                        _services.insert(std::make_pair(service_name, service));
+                    }
+                    else
+                    {
+                        service = sit->second;
+                    }
+                }
+                service->update(change.first, change.second);
+                for (auto &meta : change.first)
+                    LOG_INFO("{}-{}服务已上线，已添加至管理(zone:{} weight:{})", service_name, meta.host, meta.zone, meta.weight);
+                for (auto &host : change.second)
+                    LOG_INFO("{}-{}服务已下线，已在管理中删除", service_name, host);
+            }
         }
 
     private:
@@ -163,7 +717,90 @@ namespace chat_ns
 
     private:
         std::mutex _mutex;
-        std::unordered_set<std::string> _follow_services;
+        Locality _locality;
+        std::unordered_map<std::string, ServiceChannelOptions> _follow_services; // 关心的服务及其信道配置
         std::unordered_map<std::string, ServiceChannel::ptr> _services;
     };
-}
\ No newline at end of file
+
+    // 并发调用组：一次性发起多路下游rpc/阻塞任务，全部完成后统一收尾，总耗时取决于最慢的一路
+    // 必须通过std::make_shared创建，每一路调用都持有组的引用
+    //   auto calls = std::make_shared<CallGroup>();
+    //   stub.GetSingleFile(&cntl, &req, &rsp, calls->leg());
+    //   calls->spawn([&]() { found = _mysql_user->getUserById(uid, user); });
+    //   calls->wait();                         // 或 calls->notify([=]() { done->Run(); });
+    class CallGroup : public std::enable_shared_from_this<CallGroup>
+    {
+    public:
+        using ptr = std::shared_ptr<CallGroup>;
+        CallGroup() : _pending(1), _event(1) {} // 初始计数由wait/notify释放，防止调用发起过程中提前完成
+
+        // 生成一路rpc调用的done回调，作为stub调用的最后一个参数传入
+        google::protobuf::Closure *leg()
+        {
+            _pending.fetch_add(1);
+            return brpc::NewCallback(&CallGroup::onLegDone, shared_from_this());
+        }
+        // 在新的bthread中执行一个阻塞任务(mysql/redis等)作为一路
+        void spawn(const std::function<void()> &task)
+        {
+            _pending.fetch_add(1);
+            // 新的bthread中沿用当前的追踪上下文，任务中的调用记录为当前span的子span
+            std::function<void()> traced = task;
+            if (const TraceContext *ctx = TraceContext::current())
+            {
+                auto copy = std::make_shared<TraceContext>(*ctx);
+                traced = [copy, task]()
+                {
+                    TraceAttach attach(copy.get());
+                    task();
+                };
+            }
+            auto arg = new std::pair<CallGroup::ptr, std::function<void()>>(shared_from_this(), traced);
+            bthread_t tid;
+            if (bthread_start_background(&tid, nullptr, &CallGroup::runTask, arg) != 0)
+            {
+                LOG_WARN("启动bthread失败，任务改为同步执行！");
+                runTask(arg);
+            }
+        }
+        // 挂起当前bthread直到所有调用完成，不会阻塞worker线程
+        void wait()
+        {
+            release();
+            _event.wait();
+        }
+        // 不阻塞当前线程，所有调用完成后在最后完成的一路中执行回调（如外层done->Run()）
+        void notify(const std::function<void()> &callback)
+        {
+            _callback = callback;
+            release();
+        }
+
+    private:
+        static void onLegDone(CallGroup::ptr group)
+        {
+            group->release();
+        }
+        static void *runTask(void *arg)
+        {
+            std::unique_ptr<std::pair<CallGroup::ptr, std::function<void()>>> task(
+                static_cast<std::pair<CallGroup::ptr, std::function<void()>> *>(arg));
+            task->second();
+            task->first->release();
+            return nullptr;
+        }
+        void release()
+        {
+            if (_pending.fetch_sub(1) != 1)
+                return;
+            if (_callback)
+                _callback();
+            _event.signal();
+        }
+
+    private:
+        std::atomic<int32_t> _pending;   // 尚未完成的调用数
+        bthread::CountdownEvent _event;  // 用于wait等待
+        std::function<void()> _callback; // 用于notify回调
+    };
+}
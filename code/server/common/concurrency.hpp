@@ -0,0 +1,90 @@
+#pragma once
+#include <brpc/server.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/service.h>
+#include <map>
+#include <sstream>
+#include <charconv>
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // rpc服务器的并发限制配置，超出限制的请求立即以ELIMIT失败，而不是排队直到超时
+    // 方法级限制的取值："auto"为brpc的自适应限流，正整数为固定上限，空或"0"为不限制
+    struct ConcurrencyOptions
+    {
+        int32_t server_max_concurrency = 0;               // 整个服务器的并发上限，0表示不限制
+        std::string method_default;                       // 对服务的每个方法生效的限制
+        std::map<std::string, std::string> method_limits; // 方法名 -> 限制，覆盖method_default
+
+        // 解析形如"auto,GetMultiUserInfo=64,UserRegister=auto"的配置：不带方法名的一项作为默认限制
+        static bool parse(const std::string &spec, ConcurrencyOptions &options)
+        {
+            std::stringstream ss(spec);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                if (item.empty())
+                    continue;
+                auto pos = item.find('=');
+                std::string method = pos == std::string::npos ? "" : item.substr(0, pos);
+                std::string limit = pos == std::string::npos ? item : item.substr(pos + 1);
+                if (valid(limit) == false)
+                {
+                    LOG_ERROR("并发限制配置{}中的{}无效，应为auto或不超过{}的非负整数", spec, item, INT32_MAX);
+                    return false;
+                }
+                if (method.empty())
+                    options.method_default = limit;
+                else
+                    options.method_limits[method] = limit;
+            }
+            return true;
+        }
+        static bool valid(const std::string &limit)
+        {
+            if (limit.empty() || limit == "auto")
+                return true;
+            int32_t value = 0;
+            return number(limit, value);
+        }
+        // 整个字符串为int32范围内的非负整数时返回true
+        static bool number(const std::string &limit, int32_t &value)
+        {
+            const char *end = limit.data() + limit.size();
+            auto result = std::from_chars(limit.data(), end, value);
+            return result.ec == std::errc() && result.ptr == end && value >= 0;
+        }
+    };
+
+    // 为service的各个方法设置并发限制，需在server启动前调用
+    inline bool applyMethodConcurrency(brpc::Server &server,
+                                       google::protobuf::Service *service,
+                                       const ConcurrencyOptions &options)
+    {
+        const google::protobuf::ServiceDescriptor *desc = service->GetDescriptor();
+        for (auto &[method, limit] : options.method_limits)
+        {
+            if (desc->FindMethodByName(method) == nullptr)
+            {
+                LOG_ERROR("{}中不存在方法{}，无法设置并发限制", desc->full_name(), method);
+                return false;
+            }
+        }
+        for (int i = 0; i < desc->method_count(); i++)
+        {
+            const std::string &method = desc->method(i)->name();
+            auto it = options.method_limits.find(method);
+            const std::string &limit = it == options.method_limits.end() ? options.method_default : it->second;
+            int32_t value = 0;
+            if (limit.empty() || (ConcurrencyOptions::number(limit, value) && value == 0))
+                continue;
+            if (limit == "auto")
+                server.MaxConcurrencyOf(service, method) = "auto";
+            else
+                server.MaxConcurrencyOf(service, method) = value;
+            LOG_INFO("{}.{}的并发限制：{}", desc->full_name(), method, limit);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <brpc/server.h>
+#include <future>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "etcd.hpp"
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // 优雅下线配置
+    struct DrainOptions
+    {
+        int32_t propagate_ms = 2000; // 注销后等待服务发现传播的时间，期间仍正常处理请求
+        int32_t deadline_ms = 10000; // 停止监听后等待在途请求完成的最长时间
+    };
+
+    // 运行rpc服务器直到收到退出信号(SIGINT/SIGTERM)，然后按序下线：
+    // 注销实例 -> 等待调用方感知 -> 停止接收新请求 -> 在期限内等待在途请求完成
+    // servers为同一实例对外提供服务的全部服务器(tcp与unix域套接字)，一起停止
+    inline void runUntilDrained(const std::vector<std::shared_ptr<brpc::Server>> &servers,
+                                const Registry::ptr &registry,
+                                const DrainOptions &options = DrainOptions())
+    {
+        while (brpc::IsAskedToQuit() == false)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        LOG_INFO("收到退出信号，开始下线：注销实例");
+        if (registry)
+            registry->deregister();
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.propagate_ms));
+        LOG_INFO("停止接收新请求，等待在途请求完成(最多{}ms)", options.deadline_ms);
+        for (auto &server : servers)
+        {
+            server->Stop(0);
+        }
+        auto joined = std::async(std::launch::async, [servers]()
+                                 {
+                                     for (auto &server : servers)
+                                     {
+                                         server->Join();
+                                     } });
+        if (joined.wait_for(std::chrono::milliseconds(options.deadline_ms)) == std::future_status::timeout)
+        {
+            // 仍有请求未完成，以非0状态退出，使进程管理方能够区分正常下线与强制退出
+            LOG_WARN("等待在途请求超时，强制退出");
+            std::quick_exit(1);
+        }
+        LOG_INFO("服务已完成下线");
+    }
+    inline void runUntilDrained(const std::shared_ptr<brpc::Server> &server,
+                                const Registry::ptr &registry,
+                                const DrainOptions &options = DrainOptions())
+    {
+        runUntilDrained(std::vector<std::shared_ptr<brpc::Server>>{server}, registry, options);
+    }
+}
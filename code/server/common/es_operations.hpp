@@ -1,5 +1,6 @@
 #pragma once
 #include "icsearch.hpp"
+#include "trace.hpp"
 #include "models.hpp"
 
 namespace chat_ns
@@ -40,6 +41,7 @@ namespace chat_ns
                         const std::string &description,
                         const std::string &avatar_id)
         {
+            ScopedSpan span("es", "user.insert");
             bool ret = ESInsert(_es_client, "user")
                            .append("user_id", uid)
                            .append("nickname", nickname)
@@ -49,6 +51,7 @@ namespace chat_ns
                            .insert(uid);
             if (ret == false)
             {
+                span.fail();
                 LOG_ERROR("用户数据插入/更新失败!");
                 return false;
             }
@@ -57,6 +60,7 @@ namespace chat_ns
         }
         std::vector<User> search(const std::string &key, const std::vector<std::string> &uid_list)
         {
+            ScopedSpan span("es", "user.search");
             std::vector<User> res;
             Json::Value json_user = ESSearch(_es_client, "user")
                                         .appendShouldMatch("phone.keyword", key)
@@ -66,6 +70,7 @@ namespace chat_ns
                                         .search();
             if (json_user.isArray() == false)
             {
+                span.fail();
                 LOG_ERROR("用户搜索结果为空，或者结果不是数组类型");
                 return res;
             }
@@ -121,6 +126,7 @@ namespace chat_ns
                         const std::string &chat_session_id,
                         const std::string &content)
         {
+            ScopedSpan span("es", "message.insert");
             bool ret = ESInsert(_es_client, "message")
                            .append("message_id", message_id)
                            .append("create_time", create_time)
@@ -130,6 +136,7 @@ namespace chat_ns
                            .insert(message_id);
             if (ret == false)
             {
+                span.fail();
                 LOG_ERROR("消息数据插入/更新失败!");
                 return false;
             }
@@ -138,9 +145,11 @@ namespace chat_ns
         }
         bool remove(const std::string &mid)
         {
+            ScopedSpan span("es", "message.remove");
             bool ret = ESRemove(_es_client, "message").remove(mid);
             if (ret == false)
             {
+                span.fail();
                 LOG_ERROR("消息数据删除失败!");
                 return false;
             }
@@ -1,104 +1,706 @@
 #pragma once
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <cstdio>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <bvar/bvar.h>
+#include <butil/fast_rand.h>
 #include <etcd/Client.hpp>
 #include <etcd/KeepAlive.hpp>
 #include <etcd/Response.hpp>
 #include <etcd/Value.hpp>
 #include <etcd/Watcher.hpp>
 #include "logger.hpp"
+#include "instance.hpp"
+#include "registry_backend.hpp"
 
 namespace chat_ns
 {
+// 基于etcd v3的注册中心存储
+class EtcdBackend : public RegistryBackend
+{
+public:
+    EtcdBackend(const std::string &host) : _client(std::make_shared<etcd::Client>(host)) {}
+    ~EtcdBackend()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &[lease_id, keep_alive] : _keep_alives)
+        {
+            keep_alive->Cancel();
+        }
+    }
+    int64_t keepAlive(int ttl) override
+    {
+        auto keep_alive = _client->leasekeepalive(ttl).get();
+        if (!keep_alive)
+            return 0;
+        int64_t lease_id = keep_alive->Lease();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _keep_alives[lease_id] = keep_alive;
+        return lease_id;
+    }
+    void revoke(int64_t lease_id) override
+    {
+        std::shared_ptr<etcd::KeepAlive> keep_alive;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _keep_alives.find(lease_id);
+            if (it == _keep_alives.end())
+                return;
+            keep_alive = it->second;
+            _keep_alives.erase(it);
+        }
+        keep_alive->Cancel();
+        _client->leaserevoke(lease_id).get();
+    }
+    bool leaseAlive(int64_t lease_id) override
+    {
+        std::shared_ptr<etcd::KeepAlive> keep_alive;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _keep_alives.find(lease_id);
+            if (it == _keep_alives.end())
+                return false;
+            keep_alive = it->second;
+        }
+        // 保活失败(租约已过期或被删除)后Check抛出保活线程中的异常
+        try
+        {
+            keep_alive->Check();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("租约{}保活失败：{}", lease_id, e.what());
+            std::lock_guard<std::mutex> lock(_mutex);
+            _keep_alives.erase(lease_id);
+            return false;
+        }
+        return true;
+    }
+    bool put(const std::string &key, const std::string &value, int64_t lease_id, std::string &error) override
+    {
+        auto resp = _client->put(key, value, lease_id).get();
+        error = resp.error_message();
+        return resp.is_ok();
+    }
+    bool remove(const std::string &key, std::string &error) override
+    {
+        auto resp = _client->rm(key).get();
+        error = resp.error_message();
+        return resp.is_ok();
+    }
+    ListResult list(const std::string &prefix) override
+    {
+        ListResult result;
+        auto resp = _client->ls(prefix).get();
+        result.ok = resp.is_ok();
+        result.error = resp.error_message();
+        result.revision = resp.index();
+        for (size_t i = 0; result.ok && i < resp.keys().size(); i++)
+        {
+            result.kvs[resp.key(i)] = resp.value(i).as_string();
+        }
+        return result;
+    }
+    RegistryWatch::ptr watch(const std::string &prefix, int64_t from_revision,
+                             const WatchCallback &callback, const StopCallback &on_stopped) override
+    {
+        return std::make_shared<EtcdWatch>(*_client, prefix, from_revision, callback, on_stopped);
+    }
+
+private:
+    class EtcdWatch : public RegistryWatch
+    {
+    public:
+        EtcdWatch(etcd::Client &client, const std::string &prefix, int64_t from_revision,
+                  const WatchCallback &callback, const StopCallback &on_stopped)
+            : _cancelled(std::make_shared<std::atomic<bool>>(false))
+        {
+            _watcher = std::make_shared<etcd::Watcher>(client, prefix, from_revision, [callback](etcd::Response resp)
+                                                       { callback(convert(resp)); }, true);
+            auto cancelled = _cancelled;
+            _watcher->Wait([cancelled, on_stopped](bool)
+                           {
+                               if (*cancelled == false && on_stopped)
+                                   on_stopped(); });
+        }
+        ~EtcdWatch()
+        {
+            cancel();
+        }
+        void cancel() override
+        {
+            if (_cancelled->exchange(true) == false)
+                _watcher->Cancel();
+        }
+
+    private:
+        static WatchResponse convert(const etcd::Response &resp)
+        {
+            WatchResponse result;
+            result.ok = resp.is_ok();
+            result.error = resp.error_message();
+            // 续接的版本已被压缩时，etcd在响应中带回compact_revision(大于0)，不依赖错误信息的措辞
+            result.compacted = resp.compact_revision() > 0;
+            result.revision = resp.index();
+            for (const auto &ev : resp.events())
+            {
+                if (ev.event_type() == etcd::Event::EventType::PUT)
+                    result.events.push_back(ServiceEvent{ServiceEvent::PUT, ev.kv().key(), ev.kv().as_string()});
+                else if (ev.event_type() == etcd::Event::EventType::DELETE_)
+                    result.events.push_back(ServiceEvent{ServiceEvent::DEL, ev.prev_kv().key(), ev.prev_kv().as_string()});
+            }
+            return result;
+        }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> _cancelled;
+        std::shared_ptr<etcd::Watcher> _watcher;
+    };
+
+private:
+    std::shared_ptr<etcd::Client> _client;
+    std::mutex _mutex;
+    std::unordered_map<int64_t, std::shared_ptr<etcd::KeepAlive>> _keep_alives;
+};
+
+// 负载上报配置：按interval_ms采样，只有负载变化超过阈值时才更新注册信息
+struct LoadReportOptions
+{
+    int32_t interval_ms = 1000;     // 采样间隔，同时也是两次上报的最小间隔
+    int32_t min_inflight_delta = 8; // 在途请求数变化超过该值才上报
+    double min_cpu_delta = 0.1;     // cpu使用率变化超过该值才上报
+};
+
 class Registry
 {
 public:
     using ptr = std::shared_ptr<Registry>;
-    Registry(const std::string &host)
-        : _client(std::make_shared<etcd::Client>(host)),
-          _keep_alive(_client->leasekeepalive(3).get()),
-          _lease_id(_keep_alive->Lease()) {}
+    using LoadSampler = std::function<InstanceLoad()>;
+    Registry(const std::string &host, int ttl = 3)
+        : Registry(std::make_shared<EtcdBackend>(host), ttl) {}
+    Registry(const RegistryBackend::ptr &backend, int ttl = 3)
+        : _backend(backend),
+          _ttl(ttl),
+          _lease_id(_backend->keepAlive(ttl)),
+          _closing(false),
+          _running(false)
+    {
+        _lease_thread = std::thread(&Registry::leaseLoop, this);
+    }
 
     ~Registry()
     {
-        _keep_alive->Cancel();
+        stopLoadReport();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closing = true;
+        }
+        _cond.notify_all();
+        _lease_thread.join();
+        _backend->revoke(_lease_id);
     }
     bool registry(const std::string &key, const std::string &val)
     {
-        auto resp = _client->put(key, val, _lease_id).get();
-        if (resp.is_ok())
+        std::lock_guard<std::mutex> register_lock(_register_mutex);
+        std::string error;
+        if (_backend->put(key, val, leaseId(), error))
         {
             LOG_DEBUG("注册数据成功 {}:{}", key, val);
         }
         else
         {
-            LOG_ERROR("注册数据失败：{}", resp.error_message());
+            LOG_ERROR("注册数据失败：{}", error);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _values[key] = val;
+        return true;
+    }
+    // 以结构化的实例信息注册，供服务发现方做就近/加权路由
+    bool registry(const std::string &key, const InstanceMeta &meta)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _key = key;
+            _meta = meta;
+        }
+        return registry(key, meta.serialize());
+    }
+    // 启动负载上报，定期采样并在负载明显变化时刷新注册信息，需在registry(key, meta)之后调用
+    void startLoadReport(const LoadSampler &sampler, const LoadReportOptions &options = LoadReportOptions())
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_running || _key.empty())
+        {
+            LOG_ERROR("负载上报未启动：{}", _running ? "已在运行" : "尚未注册实例信息");
+            return;
+        }
+        _running = true;
+        _report_thread = std::thread(&Registry::reportLoop, this, sampler, options);
+    }
+
+    // 注销实例：停止负载上报并删除注册信息，调用方随即收到下线通知
+    bool deregister()
+    {
+        stopLoadReport();
+        std::lock_guard<std::mutex> register_lock(_register_mutex);
+        std::string key;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            key = _key;
+            _values.erase(key);
+        }
+        if (key.empty())
+            return true;
+        std::string error;
+        if (_backend->remove(key, error) == false)
+        {
+            LOG_ERROR("注销实例{}失败：{}", key, error);
             return false;
         }
+        LOG_INFO("注销实例成功 {}", key);
         return true;
     }
 
 private:
-    std::shared_ptr<etcd::Client> _client;
-    std::shared_ptr<etcd::KeepAlive> _keep_alive;
-    uint64_t _lease_id;
+    int64_t leaseId()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _lease_id;
+    }
+    void stopLoadReport()
+    {
+        if (!_report_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _cond.notify_all();
+        _report_thread.join();
+    }
+    // 每ttl/3检查一次租约：实例与etcd隔离超过ttl后租约被删除，注册信息随之消失，
+    // 恢复连接后重新申请租约并以最近一次注册成功的内容重新注册，不依赖进程重启
+    void leaseLoop()
+    {
+        int32_t interval_ms = std::max(100, _ttl * 1000 / 3);
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _cond.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]()
+                           { return _closing; });
+            if (_closing)
+                return;
+            lock.unlock();
+            recoverLease();
+            lock.lock();
+        }
+    }
+    void recoverLease()
+    {
+        std::lock_guard<std::mutex> register_lock(_register_mutex);
+        int64_t old_lease = leaseId();
+        if (old_lease != 0 && _backend->leaseAlive(old_lease))
+            return;
+        int64_t lease_id = _backend->keepAlive(_ttl);
+        if (lease_id == 0)
+        {
+            LOG_WARN("租约{}已失效，重新申请租约失败，稍后重试", old_lease);
+            return;
+        }
+        std::map<std::string, std::string> values;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _lease_id = lease_id;
+            values = _values;
+        }
+        LOG_WARN("租约{}已失效，以新租约{}重新注册{}项", old_lease, lease_id, values.size());
+        for (auto &[key, value] : values)
+        {
+            std::string error;
+            if (_backend->put(key, value, lease_id, error) == false)
+                LOG_ERROR("重新注册{}失败：{}", key, error);
+        }
+    }
+    void reportLoop(LoadSampler sampler, LoadReportOptions options)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _cond.wait_for(lock, std::chrono::milliseconds(options.interval_ms), [this]()
+                           { return _running == false; });
+            if (_running == false)
+                return;
+            lock.unlock();
+            InstanceLoad load = sampler();
+            lock.lock();
+            const InstanceLoad &last = _meta.load;
+            if (std::abs(load.inflight - last.inflight) < options.min_inflight_delta &&
+                std::abs(load.cpu - last.cpu) < options.min_cpu_delta)
+                continue;
+            InstanceMeta meta = _meta;
+            meta.load = load;
+            std::string key = _key;
+            std::string value = meta.serialize();
+            lock.unlock();
+            // 与租约恢复互斥，保证恢复时重新注册的是最近一次上报成功的内容
+            std::lock_guard<std::mutex> register_lock(_register_mutex);
+            std::string error;
+            bool ok = _backend->put(key, value, leaseId(), error);
+            lock.lock();
+            // 只有上报成功才记为已上报的负载，失败时下一次采样仍与上次成功的值比较并重试
+            if (ok == false)
+            {
+                LOG_WARN("上报负载失败：{}", error);
+                continue;
+            }
+            _meta.load = load;
+            _values[key] = value;
+        }
+    }
+
+private:
+    RegistryBackend::ptr _backend;
+    int _ttl;
+    int64_t _lease_id;
+    std::mutex _mutex;
+    std::mutex _register_mutex; // 串行化注册、注销与租约恢复，避免注销后又被重新注册
+    std::condition_variable _cond;
+    bool _closing;            // Registry是否正在析构
+    bool _running;            // 负载上报是否在运行
+    std::string _key;         // 注册的实例key
+    InstanceMeta _meta;       // 注册的实例信息，包含最近一次上报成功的负载
+    std::map<std::string, std::string> _values; // 注册成功的全部数据，租约失效后据此重新注册
+    std::thread _report_thread;
+    std::thread _lease_thread;
 };
 
 class Discovery
 {
 public:
-    using ptr = shared_ptr<Discovery>;
+    using ptr = std::shared_ptr<Discovery>;
     using NotifyCallback = std::function<void(const std::string &, const std::string &)>;
-    Discovery(const std::string &host, const std::string &basedir, const NotifyCallback &put_cb, const NotifyCallback &del_cb)
-        : _client(std::make_shared<etcd::Client>(host)),
-          _watcher(std::make_shared<etcd::Watcher>(*_client.get(), basedir, std::bind(&Discovery::callback, this, std::placeholders::_1), true)),
-          _put_cb(put_cb),
-          _del_cb(del_cb)
+    using BatchCallback = std::function<void(const std::vector<ServiceEvent> &)>;
+    // snapshot_file非空时，启动时先从本地快照恢复服务信息并立即可用，再异步与etcd校正
+    // 监听到的事件在debounce_ms窗口内合并，同一实例只保留最后一次变更，之后一次性回调
+    Discovery(const std::string &host, const std::string &basedir,
+              const BatchCallback &batch_cb,
+              const std::string &snapshot_file = "",
+              int32_t debounce_ms = 100)
+        : Discovery(std::make_shared<EtcdBackend>(host), basedir, batch_cb, snapshot_file, debounce_ms) {}
+    Discovery(const RegistryBackend::ptr &backend, const std::string &basedir,
+              const BatchCallback &batch_cb,
+              const std::string &snapshot_file = "",
+              int32_t debounce_ms = 100)
+        : _backend(backend),
+          _basedir(basedir),
+          _snapshot_file(snapshot_file),
+          _debounce_ms(debounce_ms),
+          _batch_cb(batch_cb),
+          _running(true),
+          _revision(0),
+          _watch_broken(false),
+          _compacted(false),
+          _watch_delivered(false)
+    {
+        _converge_latency.expose("discovery_converge");
+        _batch_size.expose("discovery_batch_size");
+        loadSnapshot();
+        _apply_thread = std::thread(&Discovery::applyLoop, this);
+        _sync_thread = std::thread(&Discovery::syncWithRegistry, this);
+    }
+    Discovery(const std::string &host, const std::string &basedir,
+              const NotifyCallback &put_cb, const NotifyCallback &del_cb,
+              const std::string &snapshot_file = "")
+        : Discovery(host, basedir, [put_cb, del_cb](const std::vector<ServiceEvent> &events)
+                    {
+                        for (auto &ev : events)
+                        {
+                            if (ev.type == ServiceEvent::PUT && put_cb)
+                                put_cb(ev.key, ev.value);
+                            else if (ev.type == ServiceEvent::DEL && del_cb)
+                                del_cb(ev.key, ev.value);
+                        } },
+                    snapshot_file) {}
+    ~Discovery()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _cond.notify_all();
+        _sync_thread.join();
+        _apply_thread.join();
+    }
+
+private:
+    // 维护监听：首次从etcd拉取全量服务信息做校正，之后从已处理的最新版本之后开始监听；
+    // 监听断开时从该版本续接，只有版本已被etcd压缩时才重新拉取全量信息并比对差异。
+    // 拉取或监听连续失败时重试间隔逐次翻倍并加入随机抖动，避免etcd恢复时所有调用方同时重连；
+    // 监听收到过事件或保持了kStableWatchMs以上才视为恢复正常，重试间隔回到初始值
+    void syncWithRegistry()
     {
-        auto resp = _client->get(basedir).get();
-        if (!resp.is_ok())
+        static const int32_t kMinBackoffMs = 200;
+        static const int32_t kMaxBackoffMs = 5000;
+        static const int32_t kStableWatchMs = 10000;
+        bool need_relist = true;
+        int32_t backoff_ms = kMinBackoffMs;
+        while (true)
         {
-            LOG_ERROR("获取目录失败：{}", resp.error_message());
+            if (need_relist)
+            {
+                auto resp = _backend->list(_basedir);
+                if (resp.ok)
+                {
+                    reconcile(resp.kvs, resp.revision);
+                    need_relist = false;
+                }
+                else
+                {
+                    LOG_ERROR("获取目录失败：{}，{}ms后重试", resp.error, backoff_ms);
+                }
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (need_relist == false)
+            {
+                int64_t from_revision = _revision + 1;
+                LOG_INFO("从版本{}开始监听{}", from_revision, _basedir);
+                _watch_broken = false;
+                _compacted = false;
+                _watch_delivered = false;
+                auto watch_start = std::chrono::steady_clock::now();
+                lock.unlock();
+                auto watcher = _backend->watch(_basedir, from_revision,
+                                               std::bind(&Discovery::callback, this, std::placeholders::_1),
+                                               std::bind(&Discovery::onWatchStopped, this));
+                lock.lock();
+                _watcher = watcher;
+                _cond.wait(lock, [this]()
+                           { return _running == false || _watch_broken; });
+                if (_running == false)
+                    break;
+                need_relist = _compacted;
+                LOG_WARN("{}监听已断开，{}", _basedir, need_relist ? "版本已被压缩，重新拉取全量信息" : "从上次的版本续接");
+                auto uptime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - watch_start);
+                bool stable = _watch_delivered || uptime.count() >= kStableWatchMs;
+                lock.unlock();
+                watcher->cancel();
+                lock.lock();
+                if (stable)
+                    backoff_ms = kMinBackoffMs;
+            }
+            // 在[backoff/2, backoff]之间随机等待
+            int32_t wait_ms = backoff_ms / 2 + (int32_t)butil::fast_rand_less_than(backoff_ms / 2 + 1);
+            _cond.wait_for(lock, std::chrono::milliseconds(wait_ms), [this]()
+                           { return _running == false; });
+            if (_running == false)
+                break;
+            backoff_ms = std::min(backoff_ms * 2, kMaxBackoffMs);
+        }
+        if (_watcher)
+            _watcher->cancel();
+    }
+    void onWatchStopped()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_running == false)
             return;
+        _watch_broken = true;
+        _cond.notify_all();
+    }
+    // 将全量信息与已知信息的差异作为事件放入待应用队列
+    void reconcile(const std::map<std::string, std::string> &services, int64_t revision)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _revision = revision;
+        // 以待应用事件覆盖后的视图作为比对基准
+        std::map<std::string, std::string> known = _services;
+        for (auto &[key, ev] : _pending)
+        {
+            if (ev.type == ServiceEvent::PUT)
+                known[key] = ev.value;
+            else
+                known.erase(key);
         }
-        int sz = resp.keys().size();
-        for (int i = 0; i < sz; i++)
+        for (auto &[key, value] : known)
         {
-            LOG_DEBUG("发现服务：{}-{}", resp.value(i).as_string(), resp.key(i));
-            if (_put_cb)
-                _put_cb(resp.key(i), resp.value(i).as_string());
+            if (services.count(key) == 0)
+            {
+                LOG_INFO("快照中的服务已不存在：{}-{}", key, value);
+                enqueue(ServiceEvent{ServiceEvent::DEL, key, value});
+            }
+        }
+        for (auto &[key, value] : services)
+        {
+            auto it = known.find(key);
+            if (it != known.end() && it->second == value)
+                continue;
+            LOG_DEBUG("发现服务：{}-{}", value, key);
+            enqueue(ServiceEvent{ServiceEvent::PUT, key, value});
         }
-        // _watcher = std::make_shared<etcd::Watcher>(*_client.get(), basedir, std::bind(&Discovery::callback, this, std::placeholders::_1), true);
     }
-
-private:
-    void callback(const etcd::Response &resp)
+    // 监听回调只做入队，不在存储的回调线程中初始化信道
+    void callback(const WatchResponse &resp)
     {
-        if (!resp.is_ok())
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!resp.ok)
         {
-            LOG_ERROR("收到错误的事件通知{}", resp.error_message());
+            LOG_ERROR("收到错误的事件通知{}", resp.error);
+            if (resp.compacted)
+            {
+                _compacted = true;
+                _watch_broken = true;
+                _cond.notify_all();
+            }
             return;
         }
-        for (const auto &ev : resp.events())
+        _watch_delivered = true;
+        _revision = std::max(_revision, resp.revision);
+        for (const auto &ev : resp.events)
+        {
+            enqueue(ev);
+            if (ev.type == ServiceEvent::PUT)
+                LOG_INFO("新增服务：{}-{}", ev.key, ev.value);
+            else
+                LOG_INFO("下线服务：{}-{}", ev.key, ev.value);
+        }
+    }
+    // 需在持有_mutex时调用
+    void enqueue(const ServiceEvent &ev)
+    {
+        if (_pending.empty())
+        {
+            _first_pending = std::chrono::steady_clock::now();
+            _cond.notify_all();
+        }
+        _pending[ev.key] = ev;
+    }
+    // 等待合并窗口结束后，将待应用事件一次性回调，并更新本地快照
+    void applyLoop()
+    {
+        while (true)
         {
-            if (ev.event_type() == etcd::Event::EventType::PUT)
+            std::map<std::string, ServiceEvent> pending;
+            std::chrono::steady_clock::time_point first_pending;
+            std::map<std::string, std::string> services;
             {
-                if (_put_cb)
-                    _put_cb(ev.kv().key(), ev.kv().as_string());
-                LOG_INFO("新增服务：{}-{}", ev.kv().key(), ev.kv().as_string());
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this]()
+                           { return _running == false || !_pending.empty(); });
+                if (_running == false)
+                    return;
+                _cond.wait_until(lock, _first_pending + std::chrono::milliseconds(_debounce_ms), [this]()
+                                 { return _running == false; });
+                if (_running == false)
+                    return;
+                pending.swap(_pending);
+                first_pending = _first_pending;
+                for (auto &[key, ev] : pending)
+                {
+                    if (ev.type == ServiceEvent::PUT)
+                        _services[key] = ev.value;
+                    else
+                        _services.erase(key);
+                }
+                services = _services;
             }
-            else if (ev.event_type() == etcd::Event::EventType::DELETE_)
+            std::vector<ServiceEvent> events;
+            events.reserve(pending.size());
+            for (auto &[key, ev] : pending)
             {
-                if (_del_cb)
-                    _del_cb(ev.prev_kv().key(), ev.prev_kv().as_string());
-                LOG_INFO("下线服务：{}-{}", ev.kv().key(), ev.kv().as_string());
+                events.push_back(ev);
             }
+            if (_batch_cb)
+                _batch_cb(events);
+            _batch_size << events.size();
+            _converge_latency << std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - first_pending)
+                                     .count();
+            saveSnapshot(services);
+        }
+    }
+    // 本地快照：{实例key: 注册信息}
+    void loadSnapshot()
+    {
+        if (_snapshot_file.empty())
+            return;
+        std::ifstream file(_snapshot_file);
+        if (!file.is_open())
+        {
+            LOG_INFO("服务发现快照{}不存在，等待从注册中心获取", _snapshot_file);
+            return;
+        }
+        std::stringstream body;
+        body << file.rdbuf();
+        Json::Value root = JsonSerializer::deserialize(body.str());
+        if (root.isObject() == false)
+        {
+            LOG_WARN("服务发现快照{}格式错误，已忽略", _snapshot_file);
+            return;
+        }
+        std::vector<ServiceEvent> events;
+        for (const auto &key : root.getMemberNames())
+        {
+            std::string value = root[key].asString();
+            _services[key] = value;
+            LOG_DEBUG("从快照恢复服务：{}-{}", value, key);
+            events.push_back(ServiceEvent{ServiceEvent::PUT, key, value});
+        }
+        if (_batch_cb)
+            _batch_cb(events);
+    }
+    // 先写临时文件再rename，避免进程中途退出留下不完整的快照
+    void saveSnapshot(const std::map<std::string, std::string> &services)
+    {
+        if (_snapshot_file.empty())
+            return;
+        Json::Value root(Json::objectValue);
+        for (auto &[key, value] : services)
+        {
+            root[key] = value;
+        }
+        std::string tmp = _snapshot_file + ".tmp";
+        std::ofstream file(tmp, std::ios::out | std::ios::trunc);
+        file << JsonSerializer::serialize(root);
+        file.close();
+        if (file.fail() || rename(tmp.c_str(), _snapshot_file.c_str()) != 0)
+        {
+            LOG_WARN("写入服务发现快照{}失败", _snapshot_file);
         }
     }
 
 private:
-    NotifyCallback _put_cb;
-    NotifyCallback _del_cb;
-    std::shared_ptr<etcd::Client> _client;
-    std::shared_ptr<etcd::Watcher> _watcher;
+    RegistryBackend::ptr _backend;
+    std::string _basedir;
+    std::string _snapshot_file;
+    int32_t _debounce_ms;
+    BatchCallback _batch_cb;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _running;
+    int64_t _revision;     // 已收到的最新版本号，监听断开后从其下一个版本续接
+    bool _watch_broken;    // 当前监听是否已断开
+    bool _compacted;       // 续接的版本是否已被etcd压缩
+    bool _watch_delivered; // 当前监听是否收到过事件
+    std::map<std::string, std::string> _services;  // 已应用的服务实例 key -> 注册信息
+    std::map<std::string, ServiceEvent> _pending;  // 待应用的事件，同一实例只保留最后一次变更
+    std::chrono::steady_clock::time_point _first_pending; // 当前批次中第一个事件的到达时间
+    bvar::LatencyRecorder _converge_latency;       // 事件到达至路由表更新完成的耗时(us)
+    bvar::IntRecorder _batch_size;                 // 每批应用的事件数
+    std::thread _apply_thread;
+    std::thread _sync_thread;
+    RegistryWatch::ptr _watcher;
 };
-}
\ No newline at end of file
+}
@@ -1,37 +1,12 @@
 #pragma once
 #include <elasticlient/client.h>
 #include <cpr/cpr.h>
-#include <json/json.h>
 #include <iostream>
 #include <memory>
 #include "logger.hpp"
+#include "json.hpp"
 namespace chat_ns
 {
-class JsonSerializer
-{
-public:
-    // 序列化
-    static std::string serialize(const Json::Value &value)
-    {
-        Json::StreamWriterBuilder writer;
-        std::ostringstream os;
-        std::unique_ptr<Json::StreamWriter> jsonWriter(writer.newStreamWriter());
-        jsonWriter->write(value, &os);
-        return os.str();
-    }
-
-    // 反序列化
-    static Json::Value deserialize(const std::string &jsonString)
-    {
-        std::istringstream is(jsonString);
-        Json::CharReaderBuilder reader;
-        Json::Value root;
-        std::string errs;
-        Json::parseFromStream(reader, is, &root, &errs);
-        return root;
-    }
-};
-
 class ESIndex
 {
 public:
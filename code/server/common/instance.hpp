@@ -0,0 +1,103 @@
+#pragma once
+#include <iostream>
+#include <unistd.h>
+#include "json.hpp"
+
+namespace chat_ns
+{
+    // 服务实例的实时负载，由实例定期上报到注册信息中
+    struct InstanceLoad
+    {
+        int32_t inflight = 0; // 正在处理的rpc请求数
+        double cpu = 0;       // cpu使用率 0~1
+    };
+
+    // 服务实例的注册信息，序列化为json作为注册中心中实例key对应的value
+    // 兼容旧格式：value为纯"ip:port"时视为只有host的实例
+    struct InstanceMeta
+    {
+        std::string host;      // 外部访问地址 ip:port
+        std::string zone;      // 所在机房/机架
+        std::string machine;   // 所在机器，默认取主机名
+        int32_t weight = 100;  // 路由权重
+        int32_t capacity = 0;  // 可承载的并发请求数，0表示未声明
+        std::string version;   // 实例版本
+        std::string unix_path; // 同机访问用的unix域套接字路径，为空表示不提供
+        InstanceLoad load;     // 实时负载
+
+        InstanceMeta() {}
+        InstanceMeta(const std::string &access_host) : host(access_host), machine(localMachine()) {}
+
+        std::string serialize() const
+        {
+            Json::Value root;
+            root["host"] = host;
+            root["zone"] = zone;
+            root["machine"] = machine;
+            root["weight"] = weight;
+            root["capacity"] = capacity;
+            root["version"] = version;
+            if (!unix_path.empty())
+                root["unix_path"] = unix_path;
+            root["load"]["inflight"] = load.inflight;
+            root["load"]["cpu"] = load.cpu;
+            return JsonSerializer::serialize(root);
+        }
+        static InstanceMeta parse(const std::string &value)
+        {
+            InstanceMeta meta;
+            if (value.empty() || value[0] != '{')
+            {
+                meta.host = value;
+                return meta;
+            }
+            Json::Value root = JsonSerializer::deserialize(value);
+            if (root.isObject() == false)
+            {
+                meta.host = value;
+                return meta;
+            }
+            meta.host = root["host"].asString();
+            meta.zone = root["zone"].asString();
+            meta.machine = root["machine"].asString();
+            meta.weight = root.get("weight", 100).asInt();
+            meta.capacity = root.get("capacity", 0).asInt();
+            meta.version = root["version"].asString();
+            meta.unix_path = root["unix_path"].asString();
+            const Json::Value &load = root["load"];
+            if (load.isObject())
+            {
+                meta.load.inflight = load.get("inflight", 0).asInt();
+                meta.load.cpu = load.get("cpu", 0).asDouble();
+            }
+            return meta;
+        }
+        static std::string localMachine()
+        {
+            char name[256] = {0};
+            if (gethostname(name, sizeof(name) - 1) != 0)
+                return std::string();
+            return name;
+        }
+    };
+
+    // 当前进程所处的位置，用于优先路由到本机/本机房的服务实例
+    struct Locality
+    {
+        std::string zone;
+        std::string machine = InstanceMeta::localMachine();
+    };
+
+    // 服务实例的上下线事件
+    struct ServiceEvent
+    {
+        enum Type
+        {
+            PUT,
+            DEL
+        };
+        Type type;
+        std::string key;   // 实例key
+        std::string value; // 注册信息，下线事件中为下线前的注册信息
+    };
+}
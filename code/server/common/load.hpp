@@ -0,0 +1,63 @@
+#pragma once
+#include <bvar/bvar.h>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include "instance.hpp"
+
+namespace chat_ns
+{
+    // 从brpc导出的bvar中采样当前进程的负载，作为Registry的负载采样函数
+    class ServerLoadSampler
+    {
+    public:
+        ServerLoadSampler(int port)
+            : _method_prefix("rpc_server_" + std::to_string(port) + "_"),
+              _ncpu(std::max(1u, std::thread::hardware_concurrency())) {}
+        InstanceLoad operator()() const
+        {
+            InstanceLoad load;
+            // 在途请求数：brpc为每个方法导出的当前并发数之和
+            std::vector<std::string> names;
+            bvar::Variable::list_exposed(&names);
+            const std::string suffix = "_concurrency";
+            for (auto &name : names)
+            {
+                if (name.compare(0, _method_prefix.size(), _method_prefix) != 0)
+                    continue;
+                if (name.size() < suffix.size() ||
+                    name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0 ||
+                    name.find("max_concurrency") != std::string::npos)
+                    continue;
+                load.inflight += readInt(name);
+            }
+            // cpu使用率：进程占用的核数 / 机器核数
+            load.cpu = std::min(1.0, readDouble("process_cpu_usage") / _ncpu);
+            return load;
+        }
+
+    private:
+        static int32_t readInt(const std::string &name)
+        {
+            return static_cast<int32_t>(readDouble(name));
+        }
+        static double readDouble(const std::string &name)
+        {
+            std::string value = bvar::Variable::describe_exposed(name);
+            if (value.empty())
+                return 0;
+            try
+            {
+                return std::stod(value);
+            }
+            catch (const std::exception &e)
+            {
+                return 0;
+            }
+        }
+
+    private:
+        std::string _method_prefix; // 本服务器方法指标的名称前缀
+        unsigned _ncpu;
+    };
+}
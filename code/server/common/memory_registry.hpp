@@ -0,0 +1,506 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include "registry_backend.hpp"
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // 进程内的注册中心，语义与etcd一致：全局递增版本号、租约过期删除、按版本续接监听、历史压缩
+    // 多个Registry/Discovery通过connect得到各自的客户端，可在单机内模拟多实例的路由、故障转移：
+    //   auto store = std::make_shared<MemoryRegistry>();
+    //   auto reg = std::make_shared<Registry>(store->connect("user-1"));
+    //   auto dis = std::make_shared<Discovery>(store->connect("gateway"), "/service", batch_cb);
+    //   store->setLatency(20);              // 所有监听通知延迟20ms送达
+    //   store->partition("user-1", true);   // user-1与注册中心断开，租约到期后其注册信息被删除
+    // 完整的多实例场景见discovery/discovery_sim.cc
+    class MemoryRegistry : public std::enable_shared_from_this<MemoryRegistry>
+    {
+    public:
+        using ptr = std::shared_ptr<MemoryRegistry>;
+        // history_limit：保留的历史事件数，超出部分被压缩，从更早版本续接的监听会收到compacted错误
+        MemoryRegistry(int32_t latency_ms = 0, size_t history_limit = 10000)
+            : _latency_ms(latency_ms),
+              _history_limit(history_limit),
+              _running(true),
+              _revision(0),
+              _compact_revision(0),
+              _next_lease_id(1),
+              _next_watch_id(1)
+        {
+            _lease_thread = std::thread(&MemoryRegistry::leaseLoop, this);
+            _dispatch_thread = std::thread(&MemoryRegistry::dispatchLoop, this);
+        }
+        ~MemoryRegistry()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            _lease_thread.join();
+            _dispatch_thread.join();
+        }
+        // 以client_id的身份连接，partition按该身份注入故障
+        RegistryBackend::ptr connect(const std::string &client_id);
+
+        // 之后产生的监听通知延迟latency_ms送达
+        void setLatency(int32_t latency_ms)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _latency_ms = latency_ms;
+        }
+        // 隔离/恢复某个客户端：隔离期间其读写失败、监听断开、租约不再续期
+        void partition(const std::string &client_id, bool isolated)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (isolated == false)
+            {
+                _isolated.erase(client_id);
+                return;
+            }
+            _isolated.insert(client_id);
+            for (auto it = _watches.begin(); it != _watches.end();)
+            {
+                if (it->second->client == client_id)
+                {
+                    schedule(it->second, true, WatchResponse());
+                    it = _watches.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            LOG_WARN("客户端{}与内存注册中心断开", client_id);
+        }
+        // 丢弃revision(含)之前的历史事件
+        void compact(int64_t revision)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            while (!_history.empty() && _history.front().first <= revision)
+            {
+                _history.pop_front();
+            }
+            _compact_revision = std::max(_compact_revision, std::min(revision, _revision));
+        }
+        int64_t revision()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _revision;
+        }
+
+    private:
+        friend class MemoryBackend;
+        struct KeyValue
+        {
+            std::string value;
+            int64_t lease_id = 0;
+        };
+        struct Lease
+        {
+            std::string client;
+            int ttl = 0;
+            bool keep_alive = true; // 客户端断开或析构后不再续期
+            std::chrono::steady_clock::time_point deadline;
+            std::set<std::string> keys;
+        };
+        struct Watch
+        {
+            uint64_t id = 0;
+            std::string client;
+            std::string prefix;
+            RegistryBackend::WatchCallback callback;
+            RegistryBackend::StopCallback on_stopped;
+            std::mutex deliver_mutex; // 保证cancel返回后不再回调
+            bool active = true;
+        };
+        struct Notification
+        {
+            std::shared_ptr<Watch> watch;
+            bool stop = false;
+            WatchResponse resp;
+        };
+        class MemoryWatch : public RegistryWatch
+        {
+        public:
+            MemoryWatch(const std::weak_ptr<MemoryRegistry> &registry, const std::shared_ptr<Watch> &watch)
+                : _registry(registry), _watch(watch) {}
+            ~MemoryWatch()
+            {
+                cancel();
+            }
+            void cancel() override
+            {
+                auto registry = _registry.lock();
+                if (registry)
+                {
+                    std::lock_guard<std::mutex> lock(registry->_mutex);
+                    registry->_watches.erase(_watch->id);
+                }
+                std::lock_guard<std::mutex> lock(_watch->deliver_mutex);
+                _watch->active = false;
+            }
+
+        private:
+            std::weak_ptr<MemoryRegistry> _registry;
+            std::shared_ptr<Watch> _watch;
+        };
+
+    private:
+        // 以下需在持有_mutex时调用
+        bool isolated(const std::string &client, std::string &error)
+        {
+            if (_isolated.count(client) == 0)
+                return false;
+            error = "client " + client + " is partitioned from registry";
+            return true;
+        }
+        static bool hasPrefix(const std::string &key, const std::string &prefix)
+        {
+            return key.compare(0, prefix.size(), prefix) == 0;
+        }
+        void schedule(const std::shared_ptr<Watch> &watch, bool stop, const WatchResponse &resp)
+        {
+            auto at = std::chrono::steady_clock::now() + std::chrono::milliseconds(_latency_ms);
+            _notifications.emplace(at, Notification{watch, stop, resp});
+            _cond.notify_all();
+        }
+        // 记录一次变更并通知匹配的监听
+        void commit(const ServiceEvent &ev)
+        {
+            int64_t revision = ++_revision;
+            _history.emplace_back(revision, ev);
+            if (_history.size() > _history_limit)
+            {
+                _compact_revision = _history.front().first;
+                _history.pop_front();
+            }
+            for (auto &[id, watch] : _watches)
+            {
+                if (hasPrefix(ev.key, watch->prefix) == false)
+                    continue;
+                WatchResponse resp;
+                resp.ok = true;
+                resp.revision = revision;
+                resp.events.push_back(ev);
+                schedule(watch, false, resp);
+            }
+        }
+        void erase(const std::string &key)
+        {
+            auto it = _kvs.find(key);
+            if (it == _kvs.end())
+                return;
+            auto lease = _leases.find(it->second.lease_id);
+            if (lease != _leases.end())
+                lease->second.keys.erase(key);
+            ServiceEvent ev{ServiceEvent::DEL, key, it->second.value};
+            _kvs.erase(it);
+            commit(ev);
+        }
+        void dropLease(int64_t lease_id)
+        {
+            auto it = _leases.find(lease_id);
+            if (it == _leases.end())
+                return;
+            std::set<std::string> keys;
+            keys.swap(it->second.keys);
+            _leases.erase(it);
+            for (auto &key : keys)
+            {
+                erase(key);
+            }
+        }
+        void disconnect(const std::string &client)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto &[id, lease] : _leases)
+            {
+                if (lease.client == client)
+                    lease.keep_alive = false;
+            }
+        }
+
+        // 客户端接口的实现
+        int64_t keepAlive(const std::string &client, int ttl)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::string error;
+            if (isolated(client, error))
+                return 0;
+            int64_t lease_id = _next_lease_id++;
+            Lease &lease = _leases[lease_id];
+            lease.client = client;
+            lease.ttl = ttl;
+            lease.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+            return lease_id;
+        }
+        void revoke(const std::string &client, int64_t lease_id)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::string error;
+            auto it = _leases.find(lease_id);
+            if (it == _leases.end())
+                return;
+            if (isolated(client, error))
+            {
+                // 与etcd一致：撤销请求发不出去，只能等租约到期
+                it->second.keep_alive = false;
+                return;
+            }
+            dropLease(lease_id);
+        }
+        bool leaseAlive(const std::string &client, int64_t lease_id)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::string error;
+            // 与etcd一致：隔离期间保活请求发不出去，客户端无从得知租约是否已过期
+            if (isolated(client, error))
+                return true;
+            return _leases.count(lease_id) != 0;
+        }
+        bool put(const std::string &client, const std::string &key, const std::string &value,
+                 int64_t lease_id, std::string &error)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (isolated(client, error))
+                return false;
+            if (lease_id != 0 && _leases.count(lease_id) == 0)
+            {
+                error = "etcdserver: requested lease not found";
+                return false;
+            }
+            KeyValue &kv = _kvs[key];
+            if (kv.lease_id != lease_id)
+            {
+                auto old = _leases.find(kv.lease_id);
+                if (old != _leases.end())
+                    old->second.keys.erase(key);
+                if (lease_id != 0)
+                    _leases[lease_id].keys.insert(key);
+            }
+            kv.value = value;
+            kv.lease_id = lease_id;
+            commit(ServiceEvent{ServiceEvent::PUT, key, value});
+            return true;
+        }
+        bool remove(const std::string &client, const std::string &key, std::string &error)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (isolated(client, error))
+                return false;
+            if (_kvs.count(key) == 0)
+            {
+                error = "etcdserver: key not found";
+                return false;
+            }
+            erase(key);
+            return true;
+        }
+        ListResult list(const std::string &client, const std::string &prefix)
+        {
+            ListResult result;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (isolated(client, result.error))
+                return result;
+            result.ok = true;
+            result.revision = _revision;
+            for (auto it = _kvs.lower_bound(prefix); it != _kvs.end() && hasPrefix(it->first, prefix); ++it)
+            {
+                result.kvs[it->first] = it->second.value;
+            }
+            return result;
+        }
+        RegistryWatch::ptr watch(const std::string &client, const std::string &prefix, int64_t from_revision,
+                                 const RegistryBackend::WatchCallback &callback,
+                                 const RegistryBackend::StopCallback &on_stopped)
+        {
+            auto watch = std::make_shared<Watch>();
+            watch->client = client;
+            watch->prefix = prefix;
+            watch->callback = callback;
+            watch->on_stopped = on_stopped;
+            std::lock_guard<std::mutex> lock(_mutex);
+            watch->id = _next_watch_id++;
+            std::string error;
+            if (isolated(client, error))
+            {
+                schedule(watch, true, WatchResponse());
+            }
+            else if (from_revision > 0 && from_revision <= _compact_revision)
+            {
+                WatchResponse resp;
+                resp.compacted = true;
+                resp.revision = _compact_revision;
+                resp.error = "etcdserver: mvcc: required revision has been compacted";
+                schedule(watch, false, resp);
+            }
+            else
+            {
+                // 补发from_revision之后的历史变更
+                if (from_revision > 0)
+                {
+                    for (auto &[revision, ev] : _history)
+                    {
+                        if (revision < from_revision || hasPrefix(ev.key, prefix) == false)
+                            continue;
+                        WatchResponse resp;
+                        resp.ok = true;
+                        resp.revision = revision;
+                        resp.events.push_back(ev);
+                        schedule(watch, false, resp);
+                    }
+                }
+                _watches[watch->id] = watch;
+            }
+            return std::make_shared<MemoryWatch>(weak_from_this(), watch);
+        }
+
+    private:
+        // 为未断开的客户端续期租约，删除已到期租约关联的key
+        void leaseLoop()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_running)
+            {
+                auto now = std::chrono::steady_clock::now();
+                std::vector<int64_t> expired;
+                for (auto &[id, lease] : _leases)
+                {
+                    if (lease.keep_alive && _isolated.count(lease.client) == 0)
+                        lease.deadline = now + std::chrono::seconds(lease.ttl);
+                    else if (lease.deadline <= now)
+                        expired.push_back(id);
+                }
+                for (auto id : expired)
+                {
+                    LOG_INFO("租约{}已到期", id);
+                    dropLease(id);
+                }
+                _cond.wait_for(lock, std::chrono::milliseconds(100), [this]()
+                               { return _running == false; });
+            }
+        }
+        // 按送达时间依次投递监听通知，回调在本线程中执行
+        void dispatchLoop()
+        {
+            while (true)
+            {
+                Notification notification;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    while (true)
+                    {
+                        if (_running == false)
+                            return;
+                        if (_notifications.empty())
+                        {
+                            _cond.wait(lock);
+                            continue;
+                        }
+                        auto at = _notifications.begin()->first;
+                        if (at <= std::chrono::steady_clock::now())
+                            break;
+                        _cond.wait_until(lock, at);
+                    }
+                    notification = std::move(_notifications.begin()->second);
+                    _notifications.erase(_notifications.begin());
+                }
+                auto &watch = notification.watch;
+                std::lock_guard<std::mutex> lock(watch->deliver_mutex);
+                if (watch->active == false)
+                    continue;
+                if (notification.stop)
+                {
+                    watch->active = false;
+                    if (watch->on_stopped)
+                        watch->on_stopped();
+                }
+                else if (watch->callback)
+                {
+                    watch->callback(notification.resp);
+                }
+            }
+        }
+
+    private:
+        int32_t _latency_ms;
+        size_t _history_limit;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _running;
+        int64_t _revision;         // 最新版本号
+        int64_t _compact_revision; // 已压缩到的版本号
+        int64_t _next_lease_id;
+        uint64_t _next_watch_id;
+        std::map<std::string, KeyValue> _kvs;
+        std::unordered_map<int64_t, Lease> _leases;
+        std::deque<std::pair<int64_t, ServiceEvent>> _history;
+        std::unordered_map<uint64_t, std::shared_ptr<Watch>> _watches;
+        std::multimap<std::chrono::steady_clock::time_point, Notification> _notifications;
+        std::set<std::string> _isolated;
+        std::thread _lease_thread;
+        std::thread _dispatch_thread;
+    };
+
+    // MemoryRegistry的一个客户端，析构时视为进程退出：租约不再续期，到期后注册信息被删除
+    class MemoryBackend : public RegistryBackend
+    {
+    public:
+        MemoryBackend(const MemoryRegistry::ptr &registry, const std::string &client_id)
+            : _registry(registry), _client_id(client_id) {}
+        ~MemoryBackend()
+        {
+            _registry->disconnect(_client_id);
+        }
+        int64_t keepAlive(int ttl) override
+        {
+            return _registry->keepAlive(_client_id, ttl);
+        }
+        void revoke(int64_t lease_id) override
+        {
+            _registry->revoke(_client_id, lease_id);
+        }
+        bool leaseAlive(int64_t lease_id) override
+        {
+            return _registry->leaseAlive(_client_id, lease_id);
+        }
+        bool put(const std::string &key, const std::string &value, int64_t lease_id, std::string &error) override
+        {
+            return _registry->put(_client_id, key, value, lease_id, error);
+        }
+        bool remove(const std::string &key, std::string &error) override
+        {
+            return _registry->remove(_client_id, key, error);
+        }
+        ListResult list(const std::string &prefix) override
+        {
+            return _registry->list(_client_id, prefix);
+        }
+        RegistryWatch::ptr watch(const std::string &prefix, int64_t from_revision,
+                                 const WatchCallback &callback, const StopCallback &on_stopped) override
+        {
+            return _registry->watch(_client_id, prefix, from_revision, callback, on_stopped);
+        }
+
+    private:
+        MemoryRegistry::ptr _registry;
+        std::string _client_id;
+    };
+
+    inline RegistryBackend::ptr MemoryRegistry::connect(const std::string &client_id)
+    {
+        return std::make_shared<MemoryBackend>(shared_from_this(), client_id);
+    }
+}
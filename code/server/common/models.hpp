@@ -13,4 +13,19 @@ namespace chat_ns
         std::string phone;       // varchar(64)
         std::string avatar_id;    // varchar(64)
     };
+
+    // 消息表messages_NN中的一行，按session_id分表
+    struct Message
+    {
+        unsigned long long id;           // bigint unsigned，分表内自增
+        std::string message_id;          // varchar(64)
+        std::string session_id;          // varchar(64)，分表键
+        std::string user_id;             // varchar(64)
+        unsigned long long message_type; // tinyint unsigned
+        unsigned long long create_time;  // timestamp，以秒级时间戳读写，同时是分区键
+        std::string content;             // text
+        std::string file_id;             // varchar(64)
+        std::string file_name;           // varchar(128)
+        unsigned long long file_size;    // int unsigned
+    };
 }
\ No newline at end of file
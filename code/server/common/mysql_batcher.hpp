@@ -0,0 +1,256 @@
+#pragma once
+#include <mysql/mysqld_error.h>
+#include <bthread/mutex.h>
+#include <bthread/condition_variable.h>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <string_view>
+#include "logger.hpp"
+#include "mysql_datasource.hpp"
+#include "mysql_statement.hpp"
+
+namespace chat_ns
+{
+    // 批量写入配置
+    struct InsertBatcherOptions
+    {
+        size_t max_rows = 0;       // 一条INSERT最多合并的行数，0表示不合并，逐条写入
+        int32_t max_delay_ms = 2;  // 第一行入队后最多等待该时间凑批
+        int32_t flushers = 2;      // 同时执行写入的线程数，前一批写入期间到达的行由其它线程或下一批带走
+    };
+
+    // 合并单行插入：各调用方的行先入队，攒满max_rows行或等待max_delay_ms后合成一条多行INSERT在主库执行，
+    // 一次提交只落盘一次；调用方在bthread中等待自己所在的批次完成，只挂起当前bthread
+    // 多行INSERT因某一行的数据被拒绝(如违反唯一约束)时，整条语句未生效，逐行重试使每个调用方只拿到自己那一行的结果；
+    // 连接断开、超时等错误时无法确定语句是否已提交，重试可能重复写入，整批返回失败
+    class InsertBatcher
+    {
+    public:
+        using ptr = std::shared_ptr<InsertBatcher>;
+
+        // placeholders：各列的占位表达式，如FROM_UNIXTIME(?)，为空时全部为?
+        InsertBatcher(const MysqlDataSource::ptr &source, const std::string &table,
+                      const std::vector<std::string> &columns, const InsertBatcherOptions &options,
+                      const std::vector<std::string> &placeholders = std::vector<std::string>())
+            : _source(source),
+              _table(table),
+              _columns(columns),
+              _placeholders(placeholders),
+              _options(options),
+              _running(true)
+        {
+            if (_placeholders.size() != _columns.size())
+                _placeholders.assign(_columns.size(), "?");
+            _insert_prefix = "INSERT INTO " + _table + " (";
+            std::string row = "(";
+            for (size_t i = 0; i < _columns.size(); i++)
+            {
+                _insert_prefix.append(i == 0 ? "" : ", ").append(_columns[i]);
+                row.append(i == 0 ? "" : ", ").append(_placeholders[i]);
+            }
+            _insert_prefix.append(") VALUES ");
+            _single_insert = _insert_prefix + row + ")";
+            std::string prefix = "mysql_batch_" + table;
+            _batch_rows.expose(prefix + "_rows");
+            _fallbacks.expose(prefix + "_fallbacks");
+            for (int32_t i = 0; i < std::max(1, options.flushers); i++)
+            {
+                _flushers.emplace_back(&InsertBatcher::flushLoop, this);
+            }
+        }
+        ~InsertBatcher()
+        {
+            {
+                std::lock_guard<bthread::Mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            for (auto &flusher : _flushers)
+            {
+                flusher.join();
+            }
+        }
+        // 插入一行并等待其所在批次执行完成；values与columns一一对应，keys为写入后需要读主库的key
+        bool insert(const std::vector<std::string_view> &values, const std::vector<std::string_view> &keys)
+        {
+            if (values.size() != _columns.size())
+            {
+                LOG_ERROR("{}表批量写入的列数不匹配：需要{}列，传入{}列", _table, _columns.size(), values.size());
+                return false;
+            }
+            Row row(values, keys);
+            {
+                std::lock_guard<bthread::Mutex> lock(_mutex);
+                if (_running == false)
+                    return false;
+                _queue.push_back(&row);
+                // 凑满一批时唤醒所有写入线程，否则只需唤醒一个开始计时
+                if (_queue.size() >= _options.max_rows)
+                    _cond.notify_all();
+                else if (_queue.size() == 1)
+                    _cond.notify_one();
+            }
+            row.done.wait();
+            return row.ok;
+        }
+
+    private:
+        struct Row
+        {
+            Row(const std::vector<std::string_view> &values, const std::vector<std::string_view> &keys)
+                : values(values), keys(keys), enqueue_time(std::chrono::steady_clock::now()), done(1) {}
+            const std::vector<std::string_view> &values;
+            const std::vector<std::string_view> &keys;
+            std::chrono::steady_clock::time_point enqueue_time;
+            bool ok = false;
+            bthread::CountdownEvent done;
+        };
+
+        void flushLoop()
+        {
+            while (true)
+            {
+                std::vector<Row *> batch;
+                {
+                    std::unique_lock<bthread::Mutex> lock(_mutex);
+                    while (_running && _queue.empty())
+                    {
+                        _cond.wait(lock);
+                    }
+                    if (_queue.empty())
+                        return;
+                    // 队首的行最多等待max_delay_ms，期间到达的行合入同一批
+                    auto deadline = _queue.front()->enqueue_time + std::chrono::milliseconds(_options.max_delay_ms);
+                    while (_running && !_queue.empty() && _queue.size() < _options.max_rows)
+                    {
+                        auto now = std::chrono::steady_clock::now();
+                        if (now >= deadline)
+                            break;
+                        _cond.wait_for(lock, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count());
+                    }
+                    size_t count = std::min(std::max<size_t>(1, _options.max_rows), _queue.size());
+                    batch.assign(_queue.begin(), _queue.begin() + count);
+                    _queue.erase(_queue.begin(), _queue.begin() + count);
+                }
+                if (!batch.empty())
+                    flush(batch);
+            }
+        }
+        // INSERT INTO table (c1, c2) VALUES ('v1', 'v2'), ('v3', 'v4')...，占位表达式中的?替换为转义后的值
+        std::string insertText(MysqlConn &conn, const std::vector<Row *> &rows) const
+        {
+            std::string sql = _insert_prefix;
+            for (size_t r = 0; r < rows.size(); r++)
+            {
+                sql.append(r == 0 ? "(" : ", (");
+                for (size_t i = 0; i < _columns.size(); i++)
+                {
+                    const std::string &placeholder = _placeholders[i];
+                    auto pos = placeholder.find('?');
+                    if (i != 0)
+                        sql.append(", ");
+                    sql.append(placeholder, 0, pos);
+                    if (pos == std::string::npos)
+                        continue;
+                    conn.appendQuoted(sql, rows[r]->values[i]);
+                    sql.append(placeholder, pos + 1, std::string::npos);
+                }
+                sql.append(")");
+            }
+            return sql;
+        }
+        // 失败时err为mysql错误码，未取得连接或未执行时为0
+        bool execute(const std::vector<Row *> &rows, unsigned int &err)
+        {
+            err = 0;
+            std::vector<std::string_view> keys;
+            for (auto row : rows)
+            {
+                keys.insert(keys.end(), row->keys.begin(), row->keys.end());
+            }
+            // 单行使用缓存的预处理语句；多行语句的文本随行数变化，若也预处理，每种行数都会在每个连接上
+            // 占用一条服务端预处理语句，很快耗尽max_prepared_stmt_count，因此拼成转义后的文本执行
+            return _source->write(keys, [&](MysqlConn &conn)
+                                  {
+                if (rows.size() > 1)
+                {
+                    if (conn.query(insertText(conn, rows)))
+                        return true;
+                    err = mysql_errno(conn.get());
+                    return false;
+                }
+                MysqlStatement stmt(conn, _single_insert);
+                for (auto &value : rows.front()->values)
+                {
+                    stmt.bind(value);
+                }
+                if (stmt.execute())
+                    return true;
+                err = stmt.errorCode();
+                return false; });
+        }
+        // 由某一行的数据引起、服务端拒绝了整条语句的错误，逐行重试是安全的
+        static bool rowError(unsigned int err)
+        {
+            switch (err)
+            {
+            case ER_DUP_ENTRY:
+            case ER_DUP_ENTRY_WITH_KEY_NAME:
+            case ER_BAD_NULL_ERROR:
+            case ER_DATA_TOO_LONG:
+            case ER_TRUNCATED_WRONG_VALUE_FOR_FIELD:
+            case ER_WARN_DATA_OUT_OF_RANGE:
+            case ER_NO_REFERENCED_ROW_2:
+                return true;
+            default:
+                return false;
+            }
+        }
+        void flush(const std::vector<Row *> &batch)
+        {
+            _batch_rows << static_cast<int64_t>(batch.size());
+            unsigned int err = 0;
+            bool ok = execute(batch, err);
+            if (ok == false && batch.size() > 1 && rowError(err))
+            {
+                _fallbacks << 1;
+                LOG_WARN("{}表{}行合并写入被拒绝(错误码{})，改为逐行写入", _table, batch.size(), err);
+                for (auto row : batch)
+                {
+                    row->ok = execute({row}, err);
+                    row->done.signal();
+                }
+                return;
+            }
+            if (ok == false && batch.size() > 1)
+                LOG_ERROR("{}表{}行合并写入失败(错误码{})，无法确定是否已写入，整批返回失败", _table, batch.size(), err);
+            for (auto row : batch)
+            {
+                row->ok = ok;
+                row->done.signal();
+            }
+        }
+
+    private:
+        MysqlDataSource::ptr _source;
+        std::string _table;
+        std::vector<std::string> _columns;
+        std::vector<std::string> _placeholders;
+        std::string _insert_prefix; // INSERT INTO table (c1, c2) VALUES
+        std::string _single_insert; // 单行插入的预处理语句
+        InsertBatcherOptions _options;
+        bthread::Mutex _mutex;
+        bthread::ConditionVariable _cond;
+        bool _running;
+        std::deque<Row *> _queue; // 等待写入的行，由调用方持有，调用方在其写入完成前一直等待
+        std::vector<std::thread> _flushers;
+        bvar::IntRecorder _batch_rows;  // 每批合并的行数
+        bvar::Adder<int64_t> _fallbacks; // 合并写入失败后逐行重试的批次数
+    };
+}
@@ -0,0 +1,289 @@
+#pragma once
+#include <mysql/mysqld_error.h>
+#include <bvar/bvar.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include "logger.hpp"
+#include "mysql_pool.hpp"
+#include "mysql_executor.hpp"
+#include "thread_pool.hpp"
+
+namespace chat_ns
+{
+    // 主从数据源配置
+    struct MysqlDataSourceOptions
+    {
+        MysqlPoolOptions primary;
+        std::vector<MysqlPoolOptions> replicas; // 为空时读写都走主库
+        int32_t read_your_writes_ms = 2000;     // 写入后该时间内，涉及同一key的读请求走主库
+        int32_t max_replica_lag_s = 5;          // 从库复制延迟超过该值时不再承担读请求
+        int32_t lag_check_ms = 1000;            // 从库复制延迟的检查间隔
+    };
+
+    // 最近写入过的key(用户id/昵称/手机号等)的记录，记录期间读取这些key的请求走主库
+    class RecentWrites
+    {
+    public:
+        using ptr = std::shared_ptr<RecentWrites>;
+        virtual ~RecentWrites() {}
+        // 记录keys，ttl_ms后过期
+        virtual void mark(const std::vector<std::string_view> &keys, int32_t ttl_ms) = 0;
+        // 任一key仍在记录中时返回true；无法确定时应返回true，宁可多读主库
+        virtual bool contains(const std::vector<std::string_view> &keys) = 0;
+    };
+
+    // 进程内的记录：只对本实例处理的读请求生效。服务多实例部署时，写入落在A实例、随后的读取落在B实例，
+    // B实例仍会读从库，需要换成多实例共享的记录(见redis_operations.hpp中的RedisRecentWrites)
+    class LocalRecentWrites : public RecentWrites
+    {
+    public:
+        void mark(const std::vector<std::string_view> &keys, int32_t ttl_ms) override
+        {
+            auto now = std::chrono::steady_clock::now();
+            auto expire = now + std::chrono::milliseconds(ttl_ms);
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto key : keys)
+            {
+                if (!key.empty())
+                    _writes[std::string(key)] = expire;
+            }
+            // 记录数翻倍时清理一次已过期的key
+            if (_writes.size() >= _purge_at)
+            {
+                for (auto it = _writes.begin(); it != _writes.end();)
+                {
+                    if (it->second <= now)
+                        it = _writes.erase(it);
+                    else
+                        ++it;
+                }
+                _purge_at = std::max<size_t>(1024, _writes.size() * 2);
+            }
+        }
+        bool contains(const std::vector<std::string_view> &keys) override
+        {
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto key : keys)
+            {
+                auto it = _writes.find(std::string(key));
+                if (it != _writes.end() && it->second > now)
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> _writes; // key -> 读主库的截止时间
+        size_t _purge_at = 1024;
+    };
+
+    // 主从分离的数据源：写请求走主库，读请求轮询复制延迟正常的从库
+    // 写入时记录涉及的key，短时间内读取这些key时改走主库，保证读到自己的写入；
+    // 该保证的范围取决于RecentWrites的实现，默认的LocalRecentWrites只在同一实例内成立
+    class MysqlDataSource
+    {
+    public:
+        using ptr = std::shared_ptr<MysqlDataSource>;
+        using Task = MysqlExecutor::Task;
+
+        // 创建主库与从库连接池，主库失败时返回空；从库失败时忽略该从库
+        // recent_writes为空时使用进程内的记录
+        static ptr create(const MysqlDataSourceOptions &options, const WorkerPool::ptr &workers,
+                          const RecentWrites::ptr &recent_writes = nullptr)
+        {
+            auto primary_pool = MysqlPool::create(options.primary);
+            if (!primary_pool)
+                return nullptr;
+            ptr source(new MysqlDataSource(options, std::make_shared<MysqlExecutor>(primary_pool, workers),
+                                           recent_writes ? recent_writes : std::make_shared<LocalRecentWrites>()));
+            for (auto &replica_options : options.replicas)
+            {
+                auto pool = MysqlPool::create(replica_options);
+                if (!pool)
+                {
+                    LOG_WARN("mysql从库{}:{}连接失败，不参与读请求", replica_options.host, replica_options.port);
+                    continue;
+                }
+                source->_replicas.push_back(std::make_unique<Replica>(pool, workers));
+            }
+            if (!source->_replicas.empty())
+                source->_monitor = std::thread(&MysqlDataSource::monitorLoop, source.get());
+            LOG_INFO("mysql数据源：主库{}:{}，从库数{}", options.primary.host, options.primary.port, source->_replicas.size());
+            return source;
+        }
+        ~MysqlDataSource()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_monitor.joinable())
+                _monitor.join();
+        }
+        // 按key读取，key在最近写入过时走主库
+        bool read(std::string_view key, const Task &task)
+        {
+            return readExecutor(recentlyWritten({key}))->execute(task);
+        }
+        // 按一组key并发执行多个读操作，任一key最近写入过时全部走主库
+        bool read(const std::vector<std::string_view> &keys, const std::vector<Task> &tasks)
+        {
+            return readExecutor(recentlyWritten(keys))->executeAll(tasks);
+        }
+        // 读取写操作前的数据等必须是最新值的读，直接走主库
+        bool readPrimary(const Task &task)
+        {
+            return readExecutor(true)->execute(task);
+        }
+        // 在主库执行写操作，并记录涉及的key
+        bool write(const std::vector<std::string_view> &keys, const Task &task)
+        {
+            bool ret = _primary->execute(task);
+            if (_replicas.empty() || keys.empty())
+                return ret;
+            _recent_writes->mark(keys, _options.read_your_writes_ms);
+            return ret;
+        }
+
+    private:
+        struct Replica
+        {
+            Replica(const MysqlPool::ptr &pool, const WorkerPool::ptr &workers)
+                : executor(std::make_shared<MysqlExecutor>(pool, workers)), healthy(true)
+            {
+                lag.expose("mysql_pool_" + pool->options().name + "_lag");
+            }
+            MysqlExecutor::ptr executor;
+            std::atomic<bool> healthy;    // 复制正常且延迟未超限
+            bvar::Status<int64_t> lag;    // 最近一次检查到的复制延迟(s)，-1表示复制未运行或检查失败
+            bool legacy_status = false;   // 该从库为8.0.22之前的版本，只在监控线程中使用
+        };
+
+        MysqlDataSource(const MysqlDataSourceOptions &options, const MysqlExecutor::ptr &primary,
+                        const RecentWrites::ptr &recent_writes)
+            : _options(options), _primary(primary), _recent_writes(recent_writes), _next(0), _running(true)
+        {
+            _primary_reads.expose("mysql_reads_primary");
+            _replica_reads.expose("mysql_reads_replica");
+        }
+        bool recentlyWritten(const std::vector<std::string_view> &keys)
+        {
+            if (_replicas.empty() || keys.empty())
+                return false;
+            return _recent_writes->contains(keys);
+        }
+        // 轮询选择健康的从库，没有可用从库时回退到主库
+        const MysqlExecutor::ptr &readExecutor(bool primary)
+        {
+            if (primary == false)
+            {
+                size_t count = _replicas.size();
+                for (size_t i = 0; i < count; i++)
+                {
+                    auto &replica = _replicas[_next.fetch_add(1, std::memory_order_relaxed) % count];
+                    if (replica->healthy.load(std::memory_order_relaxed))
+                    {
+                        _replica_reads << 1;
+                        return replica->executor;
+                    }
+                }
+            }
+            _primary_reads << 1;
+            return _primary;
+        }
+        // 查询从库的复制延迟，复制未运行或检查失败时返回-1
+        // 8.0.22起使用REPLICA/Source的命名，旧版本只支持SLAVE/Master，8.4起不再支持SLAVE的写法
+        int64_t replicaLag(Replica &replica)
+        {
+            auto &pool = replica.executor->pool();
+            auto conn = pool->acquire();
+            if (!conn)
+                return -1;
+            if (!conn.query(replica.legacy_status ? "SHOW SLAVE STATUS" : "SHOW REPLICA STATUS"))
+            {
+                // 只有语法错误说明该从库不认识REPLICA的写法；连接断开、超时、权限不足等只算本次检查失败
+                if (replica.legacy_status || mysql_errno(conn.get()) != ER_PARSE_ERROR)
+                    return -1;
+                replica.legacy_status = true;
+                LOG_INFO("mysql从库{}:{}不支持SHOW REPLICA STATUS，改用SHOW SLAVE STATUS",
+                         pool->options().host, pool->options().port);
+                if (!conn.query("SHOW SLAVE STATUS"))
+                    return -1;
+            }
+            MYSQL_RES *res = mysql_store_result(conn.get());
+            if (res == nullptr)
+            {
+                conn.checkError();
+                return -1;
+            }
+            int64_t lag = -1;
+            MYSQL_ROW row = mysql_fetch_row(res);
+            if (row != nullptr)
+            {
+                unsigned int num_fields = mysql_num_fields(res);
+                MYSQL_FIELD *fields = mysql_fetch_fields(res);
+                for (unsigned int i = 0; i < num_fields; i++)
+                {
+                    std::string_view name(fields[i].name);
+                    if ((name == "Seconds_Behind_Source" || name == "Seconds_Behind_Master") && row[i] != nullptr)
+                        lag = std::strtoll(row[i], nullptr, 10);
+                }
+            }
+            mysql_free_result(res);
+            return lag;
+        }
+        void monitorLoop()
+        {
+            while (true)
+            {
+                for (auto &replica : _replicas)
+                {
+                    int64_t lag = replicaLag(*replica);
+                    bool healthy = lag >= 0 && lag <= _options.max_replica_lag_s;
+                    if (healthy != replica->healthy.load())
+                    {
+                        auto &options = replica->executor->pool()->options();
+                        if (healthy)
+                            LOG_INFO("mysql从库{}:{}复制延迟恢复为{}s，重新承担读请求", options.host, options.port, lag);
+                        else
+                            LOG_WARN("mysql从库{}:{}复制延迟{}s，停止承担读请求", options.host, options.port, lag);
+                    }
+                    replica->lag.set_value(lag);
+                    replica->healthy.store(healthy);
+                }
+
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait_for(lock, std::chrono::milliseconds(_options.lag_check_ms), [this]()
+                               { return _running == false; });
+                if (_running == false)
+                    return;
+            }
+        }
+
+    private:
+        MysqlDataSourceOptions _options;
+        MysqlExecutor::ptr _primary;
+        RecentWrites::ptr _recent_writes;
+        std::vector<std::unique_ptr<Replica>> _replicas;
+        std::atomic<size_t> _next; // 轮询从库的游标
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _running;
+        std::thread _monitor;
+        bvar::Adder<int64_t> _primary_reads; // 走主库的读请求数
+        bvar::Adder<int64_t> _replica_reads; // 走从库的读请求数
+    };
+}
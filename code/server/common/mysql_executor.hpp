@@ -0,0 +1,89 @@
+#pragma once
+#include <bvar/bvar.h>
+#include <iostream>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include "logger.hpp"
+#include "mysql_pool.hpp"
+#include "thread_pool.hpp"
+
+namespace chat_ns
+{
+    // 在独立线程池中执行数据库操作：mysql客户端库的网络读写都是阻塞的，
+    // 直接在rpc处理函数中执行会占住bthread工作线程，少量慢查询就能拖住整个服务的调度
+    // 调用方在bthread中等待时只挂起当前bthread；线程数不超过连接池上限，排队由线程池的队列承担
+    class MysqlExecutor
+    {
+    public:
+        using ptr = std::shared_ptr<MysqlExecutor>;
+        using Task = std::function<bool(MysqlConn &conn)>;
+
+        MysqlExecutor(const MysqlPool::ptr &pool, const WorkerPool::ptr &workers)
+            : _pool(pool), _workers(workers)
+        {
+            _rejected.expose("mysql_pool_" + pool->options().name + "_rejected");
+        }
+        // 借出一个连接并在线程池中执行task，等待其完成；未取得连接或任务被拒绝时返回false
+        // workers为空时在当前线程中执行
+        bool execute(const Task &task)
+        {
+            if (!_workers)
+                return executeHere(task);
+            bool ret = false;
+            if (_workers->run([&]()
+                              { ret = executeHere(task); }) == false)
+            {
+                _rejected << 1;
+                LOG_ERROR("数据库线程池排队已满，拒绝执行");
+                return false;
+            }
+            return ret;
+        }
+        // 并发执行一组task，每个task各借出一个连接；全部成功时返回true
+        bool executeAll(const std::vector<Task> &tasks)
+        {
+            if (!_workers)
+            {
+                bool ret = true;
+                for (auto &task : tasks)
+                {
+                    ret = executeHere(task) && ret;
+                }
+                return ret;
+            }
+            std::vector<char> results(tasks.size(), 0);
+            std::vector<WorkerPool::Task> jobs;
+            jobs.reserve(tasks.size());
+            for (size_t i = 0; i < tasks.size(); i++)
+            {
+                jobs.push_back([this, &tasks, &results, i]()
+                               { results[i] = executeHere(tasks[i]); });
+            }
+            if (_workers->runAll(jobs) == false)
+            {
+                _rejected << 1;
+                LOG_ERROR("数据库线程池排队已满，拒绝执行");
+                return false;
+            }
+            return std::all_of(results.begin(), results.end(), [](char ok)
+                               { return ok != 0; });
+        }
+        const MysqlPool::ptr &pool() const { return _pool; }
+
+    private:
+        bool executeHere(const Task &task)
+        {
+            auto conn = _pool->acquire();
+            if (!conn)
+                return false;
+            return task(conn);
+        }
+
+    private:
+        MysqlPool::ptr _pool;
+        WorkerPool::ptr _workers;
+        bvar::Adder<int64_t> _rejected; // 排队已满被拒绝的操作数
+    };
+}
@@ -2,12 +2,116 @@
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <unordered_map>
+#include <functional>
+#include <string_view>
+#include <algorithm>
+#include <mutex>
+#include <iterator>
+#include <bthread/bthread.h>
 #include "utils.hpp"
 #include "models.hpp"
-#include <memory>
+#include "mysql_datasource.hpp"
+#include "mysql_statement.hpp"
+#include "mysql_rows.hpp"
+#include "mysql_batcher.hpp"
+#include "shard_router.hpp"
+#include "trace.hpp"
 
 namespace chat_ns
 {
+    // 用户表一行的只读视图，字段指向结果集缓冲区，只在行处理回调期间有效
+    struct UserRow
+    {
+        unsigned long long id = 0;
+        std::string_view user_id;
+        std::string_view nickname;
+        std::string_view description;
+        std::string_view password;
+        std::string_view phone;
+        std::string_view avatar_id;
+    };
+
+    // 请求内的用户对象缓存，用法参照odb::session：在处理函数开头构造，存续期间同一bthread中
+    // 按user_id/昵称/手机号重复查询同一用户时直接返回首次查到的结果，不再访问数据库；更新成功后同步刷新缓存
+    // 只在会多次查询同一用户的处理流程中构造，每个用户只查询一次的请求构造它没有收益
+    class UserSession
+    {
+    public:
+        enum class Key
+        {
+            USER_ID,
+            NICKNAME,
+            PHONE
+        };
+
+        UserSession() : _prev(current())
+        {
+            setCurrent(this);
+        }
+        ~UserSession()
+        {
+            setCurrent(_prev);
+        }
+        UserSession(const UserSession &) = delete;
+        UserSession &operator=(const UserSession &) = delete;
+
+        static UserSession *current()
+        {
+            return static_cast<UserSession *>(bthread_getspecific(key()));
+        }
+        const User *find(Key kind, std::string_view value) const
+        {
+            std::string user_id(value);
+            if (kind != Key::USER_ID)
+            {
+                auto &index = kind == Key::NICKNAME ? _by_nickname : _by_phone;
+                auto it = index.find(user_id);
+                if (it == index.end())
+                    return nullptr;
+                user_id = it->second;
+            }
+            auto it = _users.find(user_id);
+            return it == _users.end() ? nullptr : &it->second;
+        }
+        void put(const User &user)
+        {
+            // 昵称/手机号可能被修改，先移除旧的索引
+            auto it = _users.find(user.user_id);
+            if (it != _users.end())
+            {
+                _by_nickname.erase(it->second.nickname);
+                _by_phone.erase(it->second.phone);
+            }
+            _users[user.user_id] = user;
+            if (!user.nickname.empty())
+                _by_nickname[user.nickname] = user.user_id;
+            if (!user.phone.empty())
+                _by_phone[user.phone] = user.user_id;
+        }
+
+    private:
+        static bthread_key_t key()
+        {
+            static bthread_key_t key = []()
+            {
+                bthread_key_t k;
+                bthread_key_create(&k, nullptr);
+                return k;
+            }();
+            return key;
+        }
+        static void setCurrent(UserSession *session)
+        {
+            bthread_setspecific(key(), session);
+        }
+
+    private:
+        UserSession *_prev;
+        std::unordered_map<std::string, User> _users;               // user_id -> 用户
+        std::unordered_map<std::string, std::string> _by_nickname; // 昵称 -> user_id
+        std::unordered_map<std::string, std::string> _by_phone;    // 手机号 -> user_id
+    };
 
     class UserTable
     {   // +-------------+-----------------+------+-----+---------+----------------+
@@ -24,250 +128,392 @@ namespace chat_ns
     public:
         using ptr = std::shared_ptr<UserTable>;
 
-        UserTable()
+        // batch.max_rows大于0时，注册写入经由InsertBatcher合并为多行INSERT
+        UserTable(const MysqlDataSource::ptr &source, const InsertBatcherOptions &batch = InsertBatcherOptions())
+            : _source(source)
         {
-            mysql = Utils::mysqlInit(DB_NAME, HOST, PORT, USER, PASSWD);
-            if (mysql == nullptr)
-            {
-                exit(-1);
-            }
+            if (batch.max_rows > 0)
+                _batcher = std::make_shared<InsertBatcher>(source, "users", std::vector<std::string>(std::begin(kInsertColumns), std::end(kInsertColumns)), batch);
         }
-        ~UserTable()
+        ~UserTable() {}
+
+        bool getUserByNickname(std::string_view nickname, User &user)
         {
-            Utils::mysqlDestroy(mysql);
+            ScopedSpan span("mysql", "users.getUserByNickname");
+            static const std::string sql = "SELECT " + std::string(kUserColumns) + " FROM users WHERE nickname = ?";
+            return getUser(sql, UserSession::Key::NICKNAME, nickname, user);
         }
 
-        bool getUserByNickname(std::string_view nickname, User &user)
+        bool getUserByPhone(std::string_view phone, User &user)
         {
-            std::string sql = "SELECT * FROM users WHERE nickname = '";
-            sql.append(nickname);
-            sql.append("';");
+            ScopedSpan span("mysql", "users.getUserByPhone");
+            static const std::string sql = "SELECT " + std::string(kUserColumns) + " FROM users WHERE phone = ?";
+            return getUser(sql, UserSession::Key::PHONE, phone, user);
+        }
 
-            mtx.lock();
-            if (!Utils::mysqlQuery(mysql, sql))
-            {
-                mtx.unlock();
-                return false;
-            }
+        bool getUserById(std::string_view id, User &user)
+        {
+            ScopedSpan span("mysql", "users.getUserById");
+            static const std::string sql = "SELECT " + std::string(kUserColumns) + " FROM users WHERE user_id = ?";
+            return getUser(sql, UserSession::Key::USER_ID, id, user);
+        }
 
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+        // 登录校验只需要user_id与密码，按唯一索引nickname_i定位一行后回表取出，不读取description等其它字段
+        bool getLoginByNickname(std::string_view nickname, std::string &user_id, std::string &password)
+        {
+            ScopedSpan span("mysql", "users.getLoginByNickname");
+            static const std::string sql = "SELECT user_id, password FROM users WHERE nickname = ?";
+            if (const User *cached = findInSession(UserSession::Key::NICKNAME, nickname))
             {
-                LOG_ERROR("mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
-                return false;
+                user_id = cached->user_id;
+                password = cached->password;
+                return true;
             }
-            mtx.unlock();
+            return _source->read(nickname, [&](MysqlConn &conn)
+                                 {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(nickname);
+                stmt.result(user_id).result(password);
+                return stmt.execute() && stmt.fetch(); });
+        }
 
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row != nullptr)
+        // 按手机号查询user_id，按唯一索引phone_i定位一行后回表取出
+        bool getUserIdByPhone(std::string_view phone, std::string &user_id)
+        {
+            ScopedSpan span("mysql", "users.getUserIdByPhone");
+            static const std::string sql = "SELECT user_id FROM users WHERE phone = ?";
+            if (const User *cached = findInSession(UserSession::Key::PHONE, phone))
             {
-                user.id = std::stoull(row[0]);
-                user.user_id = row[1];
-                user.nickname = row[2];
-                user.description = row[3] ? row[3] : "";
-                user.password = row[4];
-                user.phone = row[5];
-                user.avatar_id = row[6] ? row[6] : "";
-                mysql_free_result(res);
+                user_id = cached->user_id;
                 return true;
             }
+            return _source->read(phone, [&](MysqlConn &conn)
+                                 {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(phone);
+                stmt.result(user_id);
+                return stmt.execute() && stmt.fetch(); });
+        }
 
-            mysql_free_result(res);
-            return false;
+        // 注册时检查昵称/手机号是否已被占用，只查询常量，唯一索引本身即可回答(Using index)，不回表
+        bool existsNickname(std::string_view nickname)
+        {
+            ScopedSpan span("mysql", "users.existsNickname");
+            static const std::string sql = "SELECT 1 FROM users WHERE nickname = ?";
+            return exists(sql, UserSession::Key::NICKNAME, nickname);
+        }
+        bool existsPhone(std::string_view phone)
+        {
+            ScopedSpan span("mysql", "users.existsPhone");
+            static const std::string sql = "SELECT 1 FROM users WHERE phone = ?";
+            return exists(sql, UserSession::Key::PHONE, phone);
         }
 
-        bool getUserByPhone(std::string_view phone, User &user)
+        // 批量查询用户，每查到一行调用一次handler，结果逐行从网络读取并直接交给调用方解码
+        // id去重后按kLookupChunk拆分为大小均衡的若干条IN查询并发执行，handler的调用相互串行
+        // 没有传入id时直接返回true；任一分片失败时返回false，已查到的行仍已交给handler
+        bool getUsersById(const std::vector<std::string> &ids, const std::function<void(const UserRow &row)> &handler)
         {
-            std::string sql = "SELECT * FROM users WHERE phone = '";
-            sql.append(phone);
-            sql.append("';");
+            ScopedSpan span("mysql", "users.getUsersById");
+            std::vector<std::string_view> keys(ids.begin(), ids.end());
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            if (keys.empty())
+                return true;
 
-            mtx.lock();
-            if (!Utils::mysqlQuery(mysql, sql))
+            // 列顺序与kUserColumns一致
+            std::mutex mutex;
+            auto decode = [&handler, &mutex](const MysqlRow &row)
             {
-                mtx.unlock();
-                return false;
-            }
-
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+                UserRow user;
+                user.id = row.uint64(0);
+                user.user_id = row.str(1);
+                user.nickname = row.str(2);
+                user.description = row.str(3);
+                user.password = row.str(4);
+                user.phone = row.str(5);
+                user.avatar_id = row.str(6);
+                std::lock_guard<std::mutex> lock(mutex);
+                handler(user);
+            };
+            size_t chunks = (keys.size() + kLookupChunk - 1) / kLookupChunk;
+            size_t chunk_size = (keys.size() + chunks - 1) / chunks;
+            std::vector<MysqlDataSource::Task> tasks;
+            for (size_t begin = 0; begin < keys.size(); begin += chunk_size)
             {
-                LOG_ERROR("mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
-                return false;
-            }
-            mtx.unlock();
-
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row != nullptr)
-            {
-                user.id = std::stoull(row[0]);
-                user.user_id = row[1];
-                user.nickname = row[2];
-                user.description = row[3] ? row[3] : "";
-                user.password = row[4];
-                user.phone = row[5];
-                user.avatar_id = row[6] ? row[6] : "";
-                mysql_free_result(res);
-                return true;
+                size_t end = std::min(begin + chunk_size, keys.size());
+                tasks.push_back([&keys, &decode, begin, end](MysqlConn &conn)
+                                {
+                    std::string sql = "SELECT " + std::string(kUserColumns) + " FROM users WHERE user_id IN (";
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        if (i != begin)
+                            sql.append(", ");
+                        conn.appendQuoted(sql, keys[i]);
+                    }
+                    sql.append(")");
+                    return queryRows(conn, sql, decode); });
             }
+            return _source->read(keys, tasks);
+        }
 
-            mysql_free_result(res);
-            return false;
+        bool getUsersById(const std::vector<std::string> &ids, std::unordered_map<std::string, User> &users)
+        {
+            return getUsersById(ids, [&users](const UserRow &row)
+                                {
+                                    User &user = users[std::string(row.user_id)];
+                                    user.id = row.id;
+                                    user.user_id = row.user_id;
+                                    user.nickname = row.nickname;
+                                    user.description = row.description;
+                                    user.password = row.password;
+                                    user.phone = row.phone;
+                                    user.avatar_id = row.avatar_id; });
         }
 
-        bool getUserById(std::string_view id, User &user)
+        bool createUser(const User &user)
         {
-            std::string sql = "SELECT * FROM users WHERE user_id = '";
-            sql.append(id);
-            sql.append("';");
+            ScopedSpan span("mysql", "users.createUser");
+            if (_batcher)
+                return _batcher->insert({user.user_id, user.nickname, user.description, user.password, user.phone, user.avatar_id},
+                                        {user.user_id, user.nickname, user.phone});
+
+            static const std::string sql =
+                "INSERT INTO users (user_id, nickname, description, password, phone, avatar_id) VALUES (?, ?, ?, ?, ?, ?)";
+            return _source->write({user.user_id, user.nickname, user.phone}, [&](MysqlConn &conn)
+                                  {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(user.user_id).bind(user.nickname).bind(user.description);
+                stmt.bind(user.password).bind(user.phone).bind(user.avatar_id);
+                return stmt.execute(); });
+        }
 
-            mtx.lock();
-            if (!Utils::mysqlQuery(mysql, sql))
+        bool updateUserInfo(const User &user)
+        {
+            ScopedSpan span("mysql", "users.updateUserInfo");
+            static const std::string sql =
+                "UPDATE users SET nickname = ?, description = ?, password = ?, phone = ?, avatar_id = ? WHERE user_id = ?";
+
+            // 修改昵称或手机号后，旧昵称/旧手机号的查询在从库上仍可能查到该用户，同样需要走主库，
+            // 因此先从主库读出修改前的值，与新值一起记为最近写入
+            static const std::string old_sql = "SELECT nickname, phone FROM users WHERE user_id = ?";
+            std::string old_nickname, old_phone;
+            bool found = _source->readPrimary([&](MysqlConn &conn)
+                                              {
+                MysqlStatement stmt(conn, old_sql);
+                stmt.bind(user.user_id);
+                stmt.result(old_nickname).result(old_phone);
+                return stmt.execute() && stmt.fetch(); });
+            if (found == false)
             {
-                mtx.unlock();
+                LOG_ERROR("更新用户信息时未查询到用户{}", user.user_id);
                 return false;
             }
+            std::vector<std::string_view> keys = {user.user_id, user.nickname, user.phone};
+            if (old_nickname != user.nickname)
+                keys.push_back(old_nickname);
+            if (old_phone != user.phone && !old_phone.empty())
+                keys.push_back(old_phone);
+            bool ret = _source->write(keys, [&](MysqlConn &conn)
+                                      {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(user.nickname).bind(user.description).bind(user.password);
+                stmt.bind(user.phone).bind(user.avatar_id).bind(user.user_id);
+                return stmt.execute(); });
+            UserSession *session = UserSession::current();
+            if (ret && session)
+                session->put(user);
+            return ret;
+        }
 
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
-            {
-                LOG_ERROR("mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
-                return false;
-            }
-            mtx.unlock();
+    private:
+        static constexpr size_t kLookupChunk = 500; // 单条IN查询的id数上限，过长的IN列表语句体积大且容易得到差的执行计划
+        static constexpr const char *kInsertColumns[] = {"user_id", "nickname", "description", "password", "phone", "avatar_id"};
+        // 查询列按User的字段顺序排列，与bindUser的绑定顺序一致
+        static constexpr const char *kUserColumns = "id, user_id, nickname, description, password, phone, avatar_id";
 
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row != nullptr)
-            {
-                user.id = std::stoull(row[0]);
-                user.user_id = row[1];
-                user.nickname = row[2];
-                user.description = row[3] ? row[3] : "";
-                user.password = row[4];
-                user.phone = row[5];
-                user.avatar_id = row[6] ? row[6] : "";
-                mysql_free_result(res);
+        static void bindUser(MysqlStatement &stmt, User &user)
+        {
+            stmt.result(user.id).result(user.user_id).result(user.nickname).result(user.description);
+            stmt.result(user.password).result(user.phone).result(user.avatar_id);
+        }
+        static const User *findInSession(UserSession::Key kind, std::string_view key)
+        {
+            UserSession *session = UserSession::current();
+            return session ? session->find(kind, key) : nullptr;
+        }
+        bool exists(const std::string &sql, UserSession::Key kind, std::string_view key)
+        {
+            if (findInSession(kind, key))
                 return true;
-            }
-
-            mysql_free_result(res);
-            return false;
+            unsigned long long found = 0;
+            return _source->read(key, [&](MysqlConn &conn)
+                                 {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(key);
+                stmt.result(found);
+                return stmt.execute() && stmt.fetch(); });
         }
-
-        bool getUsersById(const std::vector<std::string> &ids, std::unordered_map<std::string, User> &users)
+        // 按唯一键查询单个用户，当前请求的UserSession中已有该用户时直接返回
+        bool getUser(const std::string &sql, UserSession::Key kind, std::string_view key, User &user)
         {
-            if (ids.empty())
+            UserSession *session = UserSession::current();
+            if (const User *cached = findInSession(kind, key))
             {
-                return false; // 如果没有传入ID，直接返回false
+                user = *cached;
+                return true;
             }
+            bool ret = _source->read(key, [&](MysqlConn &conn)
+                                     {
+                MysqlStatement stmt(conn, sql);
+                stmt.bind(key);
+                bindUser(stmt, user);
+                return stmt.execute() && stmt.fetch(); });
+            if (ret && session)
+                session->put(user);
+            return ret;
+        }
 
-            // 构建SQL查询
-            std::string sql = "SELECT * FROM users WHERE user_id IN (";
-            for (size_t i = 0; i < ids.size(); ++i)
-            {
-                sql.append("'").append(ids[i]).append("'");
-                if (i < ids.size() - 1)
-                {
-                    sql.append(", ");
-                }
-            }
-            sql.append(");");
+    private:
+        MysqlDataSource::ptr _source; // 所有表共用，读请求走从库，写请求走主库
+        InsertBatcher::ptr _batcher;  // 为空时逐条写入
+    };
 
-            mtx.lock();
-            if (!Utils::mysqlQuery(mysql, sql))
-            {
-                mtx.unlock();
-                return false;
-            }
+    class MessageTable
+    {   // 按session_id哈希分为messages_00 ~ messages_NN，每张分表按create_time按月分区，见sql/messages.sql
+        // +--------------+------------------+------+-----+---------+----------------+
+        // | Field        | Type             | Null | Key | Default | Extra          |
+        // +--------------+------------------+------+-----+---------+----------------+
+        // | id           | bigint unsigned  | NO   | PRI | NULL    | auto_increment |
+        // | message_id   | varchar(64)      | NO   | MUL | NULL    |                |
+        // | session_id   | varchar(64)      | NO   | MUL | NULL    |                |
+        // | user_id      | varchar(64)      | NO   |     | NULL    |                |
+        // | message_type | tinyint unsigned | NO   |     | NULL    |                |
+        // | create_time  | timestamp        | NO   | PRI | NULL    |                |
+        // | content      | text             | YES  |     | NULL    |                |
+        // | file_id      | varchar(64)      | YES  |     | NULL    |                |
+        // | file_name    | varchar(128)     | YES  |     | NULL    |                |
+        // | file_size    | int unsigned     | YES  |     | NULL    |                |
+        // +--------------+------------------+------+-----+---------+----------------+
+    public:
+        using ptr = std::shared_ptr<MessageTable>;
 
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+        // shard_count需与建表时的分表数(sql/messages.sql中create_message_shards的参数)一致；batch.max_rows大于0时，每张分表的写入各自合并为多行INSERT
+        MessageTable(const MysqlDataSource::ptr &source, uint32_t shard_count,
+                     const InsertBatcherOptions &batch = InsertBatcherOptions())
+            : _source(source), _router("messages", shard_count)
+        {
+            for (uint32_t i = 0; i < _router.shardCount(); i++)
             {
-                LOG_ERROR("mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
-                return false;
+                Shard shard;
+                std::string table = _router.table(i);
+                std::string select = "SELECT id, message_id, session_id, user_id, message_type, UNIX_TIMESTAMP(create_time), "
+                                     "content, file_id, file_name, file_size FROM " + table;
+                shard.insert = "INSERT INTO " + table + " (message_id, session_id, user_id, message_type, create_time, "
+                               "content, file_id, file_name, file_size) VALUES (?, ?, ?, ?, FROM_UNIXTIME(?), ?, ?, ?, ?)";
+                shard.recent = select + " WHERE session_id = ? ORDER BY create_time DESC LIMIT ?";
+                shard.range = select + " WHERE session_id = ? AND create_time >= FROM_UNIXTIME(?) "
+                                       "AND create_time < FROM_UNIXTIME(?) ORDER BY create_time";
+                shard.remove = "DELETE FROM " + table + " WHERE session_id = ?";
+                if (batch.max_rows > 0)
+                    shard.batcher = std::make_shared<InsertBatcher>(source, table,
+                        std::vector<std::string>{"message_id", "session_id", "user_id", "message_type", "create_time",
+                                                 "content", "file_id", "file_name", "file_size"},
+                        batch,
+                        std::vector<std::string>{"?", "?", "?", "?", "FROM_UNIXTIME(?)", "?", "?", "?", "?"});
+                _shards.push_back(std::move(shard));
             }
-            mtx.unlock();
+        }
+        ~MessageTable() {}
 
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+        bool insert(const Message &message)
+        {
+            ScopedSpan span("mysql", "messages.insert");
+            const Shard &shard = _shards[_router.shard(message.session_id)];
+            if (shard.batcher)
             {
-                User user;
-                user.id = std::stoull(row[0]);           // id (bigint unsigned)
-                user.user_id = row[1];                    // user_id (varchar(64))
-                user.nickname = row[2];                  // nickname (varchar(64))
-                user.description = row[3] ? row[3] : ""; // description (text)
-                user.password = row[4];                  // password (varchar(64))
-                user.phone = row[5];                     // phone (varchar(64))
-                user.avatar_id = row[6] ? row[6] : "";    // avatar_id (varchar(64))
-
-                users[user.user_id] = user; // 将用户添加到哈希表中
+                std::string message_type = std::to_string(message.message_type);
+                std::string create_time = std::to_string(message.create_time);
+                std::string file_size = std::to_string(message.file_size);
+                return shard.batcher->insert({message.message_id, message.session_id, message.user_id, message_type, create_time,
+                                              message.content, message.file_id, message.file_name, file_size},
+                                             {message.session_id});
             }
-
-            mysql_free_result(res);
-            return true;
+            return _source->write({message.session_id}, [&](MysqlConn &conn)
+                                  {
+                MysqlStatement stmt(conn, shard.insert);
+                stmt.bind(message.message_id).bind(message.session_id).bind(message.user_id);
+                stmt.bind(message.message_type).bind(message.create_time).bind(message.content);
+                stmt.bind(message.file_id).bind(message.file_name).bind(message.file_size);
+                return stmt.execute(); });
         }
-
-        bool createUser(const User &user)
+        // 会话中最近的count条消息，按时间从早到晚排列
+        bool recent(const std::string &session_id, unsigned long long count, std::vector<Message> &messages)
         {
-            std::string sql;
-            sql.append("INSERT INTO users (user_id, nickname, description, password, phone, avatar_id) VALUES ('");
-            sql.append(user.user_id);
-            sql.append("', '");
-            sql.append(user.nickname);
-            sql.append("', '");
-            sql.append(user.description);
-            sql.append("', '");
-            sql.append(user.password);
-            sql.append("', '");
-            sql.append(user.phone);
-            sql.append("', '");
-            sql.append(user.avatar_id);
-            sql.append("');");
-
-            mtx.lock();
-            bool result = Utils::mysqlQuery(mysql, sql);
-            mtx.unlock();
-
-            return result;
+            ScopedSpan span("mysql", "messages.recent");
+            const Shard &shard = _shards[_router.shard(session_id)];
+            size_t first = messages.size();
+            bool ret = _source->read(session_id, [&](MysqlConn &conn)
+                                     {
+                MysqlStatement stmt(conn, shard.recent);
+                stmt.bind(session_id).bind(count);
+                return fetchMessages(stmt, messages); });
+            std::reverse(messages.begin() + first, messages.end());
+            return ret;
         }
-
-        bool updateUserInfo(const User &user)
+        // 会话中[start_time, end_time)之间的消息(秒级时间戳)，只扫描该时间段所在的月份分区
+        bool range(const std::string &session_id, unsigned long long start_time, unsigned long long end_time,
+                   std::vector<Message> &messages)
         {
-            std::string sql;
-            sql.append("UPDATE users SET nickname = '");
-            sql.append(user.nickname);
-            sql.append("', description = '");
-            sql.append(user.description);
-            sql.append("', password = '");
-            sql.append(user.password);
-            sql.append("', phone = '");
-            sql.append(user.phone);
-            sql.append("', avatar_id = '");  
-            sql.append(user.avatar_id);
-            sql.append("' WHERE user_id = '");
-            sql.append(user.user_id);
-            sql.append("';");
-
-            mtx.lock();
-            bool result = Utils::mysqlQuery(mysql, sql);
-            mtx.unlock();
-
-            return result;
+            ScopedSpan span("mysql", "messages.range");
+            const Shard &shard = _shards[_router.shard(session_id)];
+            return _source->read(session_id, [&](MysqlConn &conn)
+                                 {
+                MysqlStatement stmt(conn, shard.range);
+                stmt.bind(session_id).bind(start_time).bind(end_time);
+                return fetchMessages(stmt, messages); });
+        }
+        // 删除会话的全部消息
+        bool remove(const std::string &session_id)
+        {
+            ScopedSpan span("mysql", "messages.remove");
+            const Shard &shard = _shards[_router.shard(session_id)];
+            return _source->write({session_id}, [&](MysqlConn &conn)
+                                  {
+                MysqlStatement stmt(conn, shard.remove);
+                stmt.bind(session_id);
+                return stmt.execute(); });
         }
 
     private:
-        MYSQL *mysql; // 一个对象就是一个客户端，管理一张表
-        std::mutex mtx;
+        // 每张分表的语句，构造时生成一次
+        struct Shard
+        {
+            std::string insert;
+            std::string recent;
+            std::string range;
+            std::string remove;
+            InsertBatcher::ptr batcher;
+        };
+        static bool fetchMessages(MysqlStatement &stmt, std::vector<Message> &messages)
+        {
+            Message message;
+            stmt.result(message.id).result(message.message_id).result(message.session_id).result(message.user_id);
+            stmt.result(message.message_type).result(message.create_time).result(message.content);
+            stmt.result(message.file_id).result(message.file_name).result(message.file_size);
+            if (stmt.execute() == false)
+                return false;
+            while (stmt.fetch())
+            {
+                messages.push_back(message);
+            }
+            return stmt.failed() == false;
+        }
 
-        const char *HOST = "127.0.0.1";
-        const char *PORT = "3306";
-        const char *USER = "root";
-        const char *PASSWD = "123456";
-        const char *DB_NAME = "chat";
+    private:
+        MysqlDataSource::ptr _source;
+        ShardRouter _router;
+        std::vector<Shard> _shards;
     };
 
 } // namespace chat_ns
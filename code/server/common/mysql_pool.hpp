@@ -0,0 +1,373 @@
+#pragma once
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <bthread/mutex.h>
+#include <bthread/condition_variable.h>
+#include <bvar/bvar.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <list>
+#include <string_view>
+#include <algorithm>
+#include <chrono>
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // mysql连接池配置
+    struct MysqlPoolOptions
+    {
+        std::string name = "main";       // 连接池名称，用于指标命名
+        std::string host = "127.0.0.1";
+        uint16_t port = 3306;
+        std::string user = "root";
+        std::string password = "123456";
+        std::string db = "chat";
+        std::string charset = "utf8";
+        int32_t min_connections = 2;     // 启动时建立的连接数
+        int32_t max_connections = 16;    // 连接数上限
+        int32_t acquire_timeout_ms = 1000; // 获取连接的最长等待时间
+        int32_t idle_check_ms = 30000;   // 连接空闲超过该时间，借出前先ping检查
+        int32_t connect_timeout_s = 3;
+        int32_t read_timeout_s = 10;
+        int32_t write_timeout_s = 10;
+        // 每个连接缓存的预处理语句数上限，超出时关闭最久未使用的语句；
+        // 服务端的预处理语句总数受max_prepared_stmt_count(默认16382)限制，所有进程的所有连接共用
+        int32_t max_statements = 64;
+    };
+
+    class MysqlPool;
+
+    // 池中的一个连接
+    struct MysqlConnection
+    {
+        MYSQL *mysql = nullptr;
+        std::chrono::steady_clock::time_point last_used;
+        bool broken = false; // 发生连接级错误，归还时关闭而不是放回池中
+        size_t max_statements = 64;
+        // 该连接上已预处理的语句，按最近使用排序(表头最新)，随连接一起关闭
+        std::list<std::pair<std::string, MYSQL_STMT *>> statements;
+        std::unordered_map<std::string, std::list<std::pair<std::string, MYSQL_STMT *>>::iterator> statement_index;
+
+        // 取出已缓存的语句并标记为最近使用，未缓存时返回空
+        MYSQL_STMT *cachedStatement(const std::string &sql)
+        {
+            auto it = statement_index.find(sql);
+            if (it == statement_index.end())
+                return nullptr;
+            statements.splice(statements.begin(), statements, it->second);
+            return it->second->second;
+        }
+        // 缓存新预处理的语句，超出上限时关闭最久未使用的语句
+        // 同一连接上同时使用的语句只有少数几条，都是最近使用的，不会被淘汰
+        void cacheStatement(const std::string &sql, MYSQL_STMT *stmt)
+        {
+            statements.emplace_front(sql, stmt);
+            statement_index[sql] = statements.begin();
+            while (statements.size() > std::max<size_t>(1, max_statements))
+            {
+                mysql_stmt_close(statements.back().second);
+                statement_index.erase(statements.back().first);
+                statements.pop_back();
+            }
+        }
+        // 关闭连接及其上的全部预处理语句
+        void close()
+        {
+            for (auto &it : statements)
+            {
+                mysql_stmt_close(it.second);
+            }
+            statements.clear();
+            statement_index.clear();
+            mysql_close(mysql);
+            mysql = nullptr;
+        }
+    };
+
+    // 从连接池借出的连接，析构时自动归还
+    class MysqlConn
+    {
+    public:
+        MysqlConn() {}
+        MysqlConn(const std::shared_ptr<MysqlPool> &pool, std::unique_ptr<MysqlConnection> conn)
+            : _pool(pool), _conn(std::move(conn)) {}
+        MysqlConn(MysqlConn &&other) = default;
+        MysqlConn &operator=(MysqlConn &&other)
+        {
+            if (this != &other)
+            {
+                reset();
+                _pool = std::move(other._pool);
+                _conn = std::move(other._conn);
+            }
+            return *this;
+        }
+        ~MysqlConn()
+        {
+            reset();
+        }
+        // 提前归还连接
+        void reset();
+
+        explicit operator bool() const { return _conn != nullptr; }
+        MYSQL *get() const { return _conn->mysql; }
+        // 执行语句，失败时记录错误；连接已断开时标记为不可复用
+        bool query(const std::string &sql)
+        {
+            if (mysql_real_query(_conn->mysql, sql.data(), sql.size()) == 0)
+                return true;
+            LOG_ERROR("mysql query error: {} - {}", sql, mysql_error(_conn->mysql));
+            checkError();
+            return false;
+        }
+        // 将value转义后加上单引号追加到sql中，用于拼接文本语句
+        void appendQuoted(std::string &sql, std::string_view value)
+        {
+            size_t size = sql.size();
+            sql.resize(size + value.size() * 2 + 3);
+            sql[size] = '\'';
+            size_t escaped = mysql_real_escape_string(_conn->mysql, sql.data() + size + 1, value.data(), value.size());
+            sql.resize(size + 1 + escaped);
+            sql.push_back('\'');
+        }
+        // 获取该连接上已预处理的语句，首次使用时预处理并缓存，失败返回空
+        MYSQL_STMT *prepare(const std::string &sql)
+        {
+            MYSQL_STMT *cached = _conn->cachedStatement(sql);
+            if (cached != nullptr)
+                return cached;
+            MYSQL_STMT *stmt = mysql_stmt_init(_conn->mysql);
+            if (stmt == nullptr)
+            {
+                LOG_ERROR("mysql stmt init error: {}", mysql_error(_conn->mysql));
+                checkError();
+                return nullptr;
+            }
+            if (mysql_stmt_prepare(stmt, sql.data(), sql.size()) != 0)
+            {
+                LOG_ERROR("mysql prepare error: {} - {}", sql, mysql_stmt_error(stmt));
+                checkError(mysql_stmt_errno(stmt));
+                mysql_stmt_close(stmt);
+                return nullptr;
+            }
+            _conn->cacheStatement(sql, stmt);
+            return stmt;
+        }
+        // 根据最近一次错误判断连接是否还能复用
+        void checkError()
+        {
+            checkError(mysql_errno(_conn->mysql));
+        }
+        void checkError(unsigned int err)
+        {
+            if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST ||
+                err == CR_CONNECTION_ERROR || err == CR_COMMANDS_OUT_OF_SYNC)
+                _conn->broken = true;
+        }
+
+    private:
+        std::shared_ptr<MysqlPool> _pool;
+        std::unique_ptr<MysqlConnection> _conn;
+    };
+
+    // 有界mysql连接池：借出时按需新建连接，达到上限后等待归还，超时返回空连接
+    // 使用bthread同步原语，在bthread中等待连接时只挂起当前bthread
+    class MysqlPool : public std::enable_shared_from_this<MysqlPool>
+    {
+    public:
+        using ptr = std::shared_ptr<MysqlPool>;
+        // 建立min_connections个连接，失败返回空
+        static ptr create(const MysqlPoolOptions &options)
+        {
+            ptr pool(new MysqlPool(options));
+            for (int32_t i = 0; i < options.min_connections; i++)
+            {
+                auto conn = pool->connect();
+                if (!conn)
+                {
+                    LOG_ERROR("mysql连接池{}初始化失败：无法连接{}:{}", options.name, options.host, options.port);
+                    return nullptr;
+                }
+                pool->_idle.push_back(std::move(conn));
+                pool->_total++;
+            }
+            LOG_INFO("mysql连接池{}已连接{}:{}/{}，初始连接数{}，上限{}", options.name, options.host,
+                     options.port, options.db, options.min_connections, options.max_connections);
+            return pool;
+        }
+        ~MysqlPool()
+        {
+            for (auto &conn : _idle)
+            {
+                conn->close();
+            }
+        }
+        // 借出一个可用连接，超时或无法建立连接时返回空连接
+        MysqlConn acquire()
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = start + std::chrono::milliseconds(_options.acquire_timeout_ms);
+            std::unique_ptr<MysqlConnection> conn;
+            {
+                std::unique_lock<bthread::Mutex> lock(_mutex);
+                while (_idle.empty() && _total >= _options.max_connections)
+                {
+                    auto now = std::chrono::steady_clock::now();
+                    if (now >= deadline)
+                    {
+                        _acquire_timeouts << 1;
+                        LOG_ERROR("获取mysql连接超时({}ms)，连接池{}已满", _options.acquire_timeout_ms, _options.name);
+                        return MysqlConn();
+                    }
+                    _waiting++;
+                    _cond.wait_for(lock, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count());
+                    _waiting--;
+                }
+                if (!_idle.empty())
+                {
+                    conn = std::move(_idle.back());
+                    _idle.pop_back();
+                }
+                else
+                {
+                    // 先占用名额，在锁外建立连接
+                    _total++;
+                }
+            }
+            if (conn)
+                conn = validate(std::move(conn));
+            else
+                conn = connect();
+            if (!conn)
+            {
+                std::lock_guard<bthread::Mutex> lock(_mutex);
+                _total--;
+                _cond.notify_one();
+                return MysqlConn();
+            }
+            _acquire_latency << std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+            return MysqlConn(shared_from_this(), std::move(conn));
+        }
+        const MysqlPoolOptions &options() const { return _options; }
+
+    private:
+        friend class MysqlConn;
+        MysqlPool(const MysqlPoolOptions &options)
+            : _options(options),
+              _total(0),
+              _waiting(0),
+              _total_status(totalConnections, this),
+              _idle_status(idleConnections, this),
+              _waiting_status(waitingCallers, this)
+        {
+            std::string prefix = "mysql_pool_" + options.name;
+            _total_status.expose(prefix + "_total");
+            _idle_status.expose(prefix + "_idle");
+            _waiting_status.expose(prefix + "_waiting");
+            _acquire_latency.expose(prefix + "_acquire");
+            _acquire_timeouts.expose(prefix + "_acquire_timeouts");
+            _reconnects.expose(prefix + "_reconnects");
+        }
+        std::unique_ptr<MysqlConnection> connect()
+        {
+            MYSQL *mysql = mysql_init(nullptr);
+            if (mysql == nullptr)
+            {
+                LOG_ERROR("初始化mysql句柄失败");
+                return nullptr;
+            }
+            unsigned int connect_timeout = _options.connect_timeout_s;
+            unsigned int read_timeout = _options.read_timeout_s;
+            unsigned int write_timeout = _options.write_timeout_s;
+            mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+            mysql_options(mysql, MYSQL_OPT_READ_TIMEOUT, &read_timeout);
+            mysql_options(mysql, MYSQL_OPT_WRITE_TIMEOUT, &write_timeout);
+            mysql_options(mysql, MYSQL_SET_CHARSET_NAME, _options.charset.c_str());
+            if (mysql_real_connect(mysql, _options.host.c_str(), _options.user.c_str(), _options.password.c_str(),
+                                   _options.db.c_str(), _options.port, nullptr, 0) == nullptr)
+            {
+                LOG_ERROR("连接mysql服务器{}:{}失败：{}", _options.host, _options.port, mysql_error(mysql));
+                mysql_close(mysql);
+                return nullptr;
+            }
+            auto conn = std::make_unique<MysqlConnection>();
+            conn->mysql = mysql;
+            conn->last_used = std::chrono::steady_clock::now();
+            conn->max_statements = std::max(1, _options.max_statements);
+            return conn;
+        }
+        // 空闲较久的连接可能已被服务端关闭，借出前ping检查，失败则重连
+        std::unique_ptr<MysqlConnection> validate(std::unique_ptr<MysqlConnection> conn)
+        {
+            auto idle = std::chrono::steady_clock::now() - conn->last_used;
+            if (idle < std::chrono::milliseconds(_options.idle_check_ms))
+                return conn;
+            if (mysql_ping(conn->mysql) == 0)
+                return conn;
+            LOG_WARN("mysql连接已失效({})，重新连接", mysql_error(conn->mysql));
+            conn->close();
+            _reconnects << 1;
+            return connect();
+        }
+        void release(std::unique_ptr<MysqlConnection> conn)
+        {
+            std::lock_guard<bthread::Mutex> lock(_mutex);
+            if (conn->broken)
+            {
+                conn->close();
+                _total--;
+                _reconnects << 1;
+            }
+            else
+            {
+                conn->last_used = std::chrono::steady_clock::now();
+                _idle.push_back(std::move(conn));
+            }
+            _cond.notify_one();
+        }
+        static int32_t totalConnections(void *arg)
+        {
+            auto pool = static_cast<MysqlPool *>(arg);
+            std::lock_guard<bthread::Mutex> lock(pool->_mutex);
+            return pool->_total;
+        }
+        static int32_t idleConnections(void *arg)
+        {
+            auto pool = static_cast<MysqlPool *>(arg);
+            std::lock_guard<bthread::Mutex> lock(pool->_mutex);
+            return static_cast<int32_t>(pool->_idle.size());
+        }
+        static int32_t waitingCallers(void *arg)
+        {
+            auto pool = static_cast<MysqlPool *>(arg);
+            std::lock_guard<bthread::Mutex> lock(pool->_mutex);
+            return pool->_waiting;
+        }
+
+    private:
+        MysqlPoolOptions _options;
+        bthread::Mutex _mutex;
+        bthread::ConditionVariable _cond;
+        std::vector<std::unique_ptr<MysqlConnection>> _idle; // 空闲连接，后进先出，使热连接优先被复用
+        int32_t _total;   // 已建立(含正在建立)的连接数
+        int32_t _waiting; // 等待连接的调用方数
+        bvar::PassiveStatus<int32_t> _total_status;
+        bvar::PassiveStatus<int32_t> _idle_status;
+        bvar::PassiveStatus<int32_t> _waiting_status;
+        bvar::LatencyRecorder _acquire_latency;  // 获取连接耗时(us)
+        bvar::Adder<int64_t> _acquire_timeouts;  // 获取连接超时次数
+        bvar::Adder<int64_t> _reconnects;        // 因连接失效而重建的次数
+    };
+
+    inline void MysqlConn::reset()
+    {
+        if (_pool && _conn)
+            _pool->release(std::move(_conn));
+        _pool.reset();
+    }
+}
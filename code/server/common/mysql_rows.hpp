@@ -0,0 +1,73 @@
+#pragma once
+#include <mysql/mysql.h>
+#include <iostream>
+#include <functional>
+#include <string_view>
+#include <charconv>
+#include "logger.hpp"
+#include "mysql_pool.hpp"
+
+namespace chat_ns
+{
+    // 结果集中一行的只读视图，字段直接指向客户端库的行缓冲区，只在行处理回调期间有效
+    class MysqlRow
+    {
+    public:
+        MysqlRow(MYSQL_ROW row, unsigned long *lengths, unsigned int fields)
+            : _row(row), _lengths(lengths), _fields(fields) {}
+        unsigned int size() const { return _fields; }
+        bool isNull(unsigned int i) const { return _row[i] == nullptr; }
+        // NULL列返回空串
+        std::string_view str(unsigned int i) const
+        {
+            if (_row[i] == nullptr)
+                return std::string_view();
+            return std::string_view(_row[i], _lengths[i]);
+        }
+        // NULL或无法解析的列返回0
+        unsigned long long uint64(unsigned int i) const
+        {
+            unsigned long long value = 0;
+            if (_row[i] != nullptr)
+                std::from_chars(_row[i], _row[i] + _lengths[i], value);
+            return value;
+        }
+
+    private:
+        MYSQL_ROW _row;
+        unsigned long *_lengths;
+        unsigned int _fields;
+    };
+
+    using RowHandler = std::function<void(const MysqlRow &row)>;
+
+    // 执行查询并用mysql_use_result逐行读取，每读到一行调用一次handler，不在客户端缓存整个结果集
+    // 读取期间连接被占用，handler中只做解码，不要再访问数据库
+    inline bool queryRows(MysqlConn &conn, const std::string &sql, const RowHandler &handler)
+    {
+        if (!conn.query(sql))
+            return false;
+        MYSQL_RES *res = mysql_use_result(conn.get());
+        if (res == nullptr)
+        {
+            LOG_ERROR("mysql use result error: {}", mysql_error(conn.get()));
+            conn.checkError();
+            return false;
+        }
+        unsigned int fields = mysql_num_fields(res);
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(res)) != nullptr)
+        {
+            handler(MysqlRow(row, mysql_fetch_lengths(res), fields));
+        }
+        // 逐行读取时网络错误在读完之前出现，mysql_fetch_row同样返回空
+        bool ok = mysql_errno(conn.get()) == 0;
+        if (!ok)
+        {
+            LOG_ERROR("mysql fetch row error: {} - {}", sql, mysql_error(conn.get()));
+            conn.checkError();
+        }
+        mysql_free_result(res);
+        return ok;
+    }
+}
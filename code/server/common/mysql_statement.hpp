@@ -0,0 +1,220 @@
+#pragma once
+#include <mysql/mysql.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string_view>
+#include <type_traits>
+#include "logger.hpp"
+#include "mysql_pool.hpp"
+
+namespace chat_ns
+{
+    // 使用二进制协议执行预处理语句：参数按位置绑定，结果直接写入调用方给出的变量
+    // 语句缓存在借出的连接上，同一连接上再次执行相同sql时不再预处理
+    // 用法：
+    //   MysqlStatement stmt(conn, "SELECT id, nickname FROM users WHERE user_id = ?");
+    //   stmt.bind(user_id);
+    //   stmt.result(user.id); stmt.result(user.nickname);
+    //   if (stmt.execute() && stmt.fetch()) ...
+    class MysqlStatement
+    {
+    public:
+        // 8.0之前的客户端库使用my_bool，之后使用bool
+        using mysql_bool = std::remove_pointer_t<decltype(MYSQL_BIND::is_null)>;
+
+        MysqlStatement(MysqlConn &conn, const std::string &sql)
+            : _conn(conn), _sql(sql), _stmt(conn.prepare(sql)), _executed(false), _failed(false) {}
+        MysqlStatement(const MysqlStatement &) = delete;
+        MysqlStatement &operator=(const MysqlStatement &) = delete;
+        ~MysqlStatement()
+        {
+            // 释放未读完的结果集，语句留在缓存中供下次使用
+            if (_stmt && _executed)
+                mysql_stmt_free_result(_stmt);
+        }
+        explicit operator bool() const { return _stmt != nullptr; }
+
+        // 按sql中?的顺序绑定参数，参数需在execute返回前保持有效
+        MysqlStatement &bind(std::string_view value)
+        {
+            Param param;
+            param.type = MYSQL_TYPE_STRING;
+            param.data = value.data();
+            param.length = value.size();
+            _params.push_back(param);
+            return *this;
+        }
+        MysqlStatement &bind(unsigned long long value)
+        {
+            Param param;
+            param.type = MYSQL_TYPE_LONGLONG;
+            param.number = value;
+            _params.push_back(param);
+            return *this;
+        }
+        // 按查询列的顺序绑定结果变量，NULL列读出为空字符串/0
+        MysqlStatement &result(std::string &value)
+        {
+            Column column;
+            column.str = &value;
+            column.buffer.resize(kStringBuffer);
+            _columns.push_back(std::move(column));
+            return *this;
+        }
+        MysqlStatement &result(unsigned long long &value)
+        {
+            Column column;
+            column.number = &value;
+            _columns.push_back(std::move(column));
+            return *this;
+        }
+
+        bool execute()
+        {
+            if (_stmt == nullptr)
+                return false;
+            if (_params.size() != mysql_stmt_param_count(_stmt))
+            {
+                LOG_ERROR("mysql stmt参数个数不匹配：{}，需要{}个，绑定了{}个", _sql, mysql_stmt_param_count(_stmt), _params.size());
+                return false;
+            }
+            std::vector<MYSQL_BIND> binds(_params.size());
+            for (size_t i = 0; i < _params.size(); i++)
+            {
+                Param &param = _params[i];
+                binds[i].buffer_type = param.type;
+                if (param.type == MYSQL_TYPE_STRING)
+                {
+                    binds[i].buffer = const_cast<char *>(param.data);
+                    binds[i].buffer_length = param.length;
+                    binds[i].length = &param.length;
+                }
+                else
+                {
+                    binds[i].buffer = &param.number;
+                    binds[i].is_unsigned = 1;
+                }
+            }
+            if (!binds.empty() && mysql_stmt_bind_param(_stmt, binds.data()) != 0)
+                return error("bind param");
+            if (mysql_stmt_execute(_stmt) != 0)
+                return error("execute");
+            _executed = true;
+            if (_columns.empty())
+                return true;
+
+            _result_binds.assign(_columns.size(), MYSQL_BIND());
+            for (size_t i = 0; i < _columns.size(); i++)
+            {
+                Column &column = _columns[i];
+                MYSQL_BIND &bind = _result_binds[i];
+                if (column.number)
+                {
+                    bind.buffer_type = MYSQL_TYPE_LONGLONG;
+                    bind.buffer = column.number;
+                    bind.is_unsigned = 1;
+                }
+                else
+                {
+                    bind.buffer_type = MYSQL_TYPE_STRING;
+                    bind.buffer = column.buffer.data();
+                    bind.buffer_length = column.buffer.size();
+                    bind.length = &column.length;
+                }
+                bind.is_null = &column.is_null;
+                bind.error = &column.truncated;
+            }
+            if (mysql_stmt_bind_result(_stmt, _result_binds.data()) != 0)
+                return error("bind result");
+            return true;
+        }
+        // 读取下一行到绑定的结果变量中，没有更多行或出错时返回false
+        bool fetch()
+        {
+            int ret = mysql_stmt_fetch(_stmt);
+            if (ret == MYSQL_NO_DATA)
+                return false;
+            if (ret == 1)
+                return error("fetch");
+            for (size_t i = 0; i < _columns.size(); i++)
+            {
+                Column &column = _columns[i];
+                if (column.number)
+                {
+                    if (column.is_null)
+                        *column.number = 0;
+                    continue;
+                }
+                if (column.is_null)
+                {
+                    column.str->clear();
+                    continue;
+                }
+                if (column.length <= column.buffer.size())
+                {
+                    column.str->assign(column.buffer.data(), column.length);
+                    continue;
+                }
+                // 超出缓冲区的长字段(如text)单独读取
+                column.str->resize(column.length);
+                MYSQL_BIND bind{};
+                bind.buffer_type = MYSQL_TYPE_STRING;
+                bind.buffer = column.str->data();
+                bind.buffer_length = column.length;
+                if (mysql_stmt_fetch_column(_stmt, &bind, static_cast<unsigned int>(i), 0) != 0)
+                    return error("fetch column");
+            }
+            return true;
+        }
+        // 是否发生过错误，用于区分fetch返回false是读完还是出错
+        bool failed() const { return _failed || _stmt == nullptr; }
+        // 最近一次失败的mysql错误码，未失败时为0
+        unsigned int errorCode() const
+        {
+            return _stmt == nullptr ? 0 : mysql_stmt_errno(_stmt);
+        }
+        // INSERT/UPDATE/DELETE影响的行数
+        unsigned long long affectedRows() const
+        {
+            return mysql_stmt_affected_rows(_stmt);
+        }
+
+    private:
+        static constexpr size_t kStringBuffer = 256; // varchar(64)按utf8mb4计算的最大字节数
+
+        struct Param
+        {
+            enum_field_types type;
+            const char *data = nullptr;
+            unsigned long length = 0;
+            unsigned long long number = 0;
+        };
+        struct Column
+        {
+            std::string *str = nullptr;
+            unsigned long long *number = nullptr;
+            std::vector<char> buffer;
+            unsigned long length = 0;
+            mysql_bool is_null = 0;
+            mysql_bool truncated = 0;
+        };
+        bool error(const char *stage)
+        {
+            LOG_ERROR("mysql stmt {} error: {} - {}", stage, _sql, mysql_stmt_error(_stmt));
+            _failed = true;
+            _conn.checkError(mysql_stmt_errno(_stmt));
+            return false;
+        }
+
+    private:
+        MysqlConn &_conn;
+        std::string _sql;
+        MYSQL_STMT *_stmt;
+        bool _executed;
+        bool _failed;
+        std::vector<Param> _params;
+        std::vector<Column> _columns;
+        std::vector<MYSQL_BIND> _result_binds;
+    };
+}
@@ -1,5 +1,7 @@
 #pragma once
-#include <sw/redis++/redis.h>
+#include <sw/redis++/redis++.h>
+#include "trace.hpp"
+#include "mysql_datasource.hpp"
 
 namespace chat_ns
 {
@@ -29,14 +31,17 @@ namespace chat_ns
         Session(const std::shared_ptr<sw::redis::Redis> &redis_client) : _redis_client(redis_client) {}
         void append(const std::string &ssid, const std::string &uid)
         {
+            ScopedSpan span("redis", "session.set");
             _redis_client->set(ssid, uid);
         }
         void remove(const std::string &ssid)
         {
+            ScopedSpan span("redis", "session.del");
             _redis_client->del(ssid);
         }
         sw::redis::OptionalString uid(const std::string &ssid)
         {
+            ScopedSpan span("redis", "session.get");
             return _redis_client->get(ssid);
         }
 
@@ -50,14 +55,17 @@ namespace chat_ns
         Status(const std::shared_ptr<sw::redis::Redis> &redis_client) : _redis_client(redis_client) {}
         void append(const std::string &uid)
         {
+            ScopedSpan span("redis", "status.set");
             _redis_client->set(uid, "");
         }
         void remove(const std::string &uid)
         {
+            ScopedSpan span("redis", "status.del");
             _redis_client->del(uid);
         }
         bool exists(const std::string &uid)
         {
+            ScopedSpan span("redis", "status.get");
             auto res = _redis_client->get(uid);
             if (res)
                 return true;
@@ -75,18 +83,80 @@ namespace chat_ns
         void append(const std::string &cid, const std::string &code,
                     const std::chrono::milliseconds &t = std::chrono::milliseconds(300000))
         {
+            ScopedSpan span("redis", "codes.set");
             _redis_client->set(cid, code, t);
         }
         void remove(const std::string &cid)
         {
+            ScopedSpan span("redis", "codes.del");
             _redis_client->del(cid);
         }
         sw::redis::OptionalString code(const std::string &cid)
         {
+            ScopedSpan span("redis", "codes.get");
             return _redis_client->get(cid);
         }
 
     private:
         std::shared_ptr<sw::redis::Redis> _redis_client;
     };
-}
\ No newline at end of file
+
+    // 保存在Redis中的最近写入记录，服务的多个实例共享：写入落在任一实例，之后的读取落在其它实例时同样走主库
+    // 每个key一条带过期时间的记录；Redis不可用时读请求全部走主库
+    class RedisRecentWrites : public RecentWrites
+    {
+    public:
+        RedisRecentWrites(const std::shared_ptr<sw::redis::Redis> &redis_client,
+                          const std::string &prefix = "mysql_recent_write:")
+            : _redis_client(redis_client), _prefix(prefix) {}
+        void mark(const std::vector<std::string_view> &keys, int32_t ttl_ms) override
+        {
+            ScopedSpan span("redis", "recent_writes.set");
+            try
+            {
+                auto pipe = _redis_client->pipeline(false);
+                for (auto key : keys)
+                {
+                    if (!key.empty())
+                        pipe.set(name(key), "", std::chrono::milliseconds(ttl_ms));
+                }
+                pipe.exec();
+            }
+            catch (const sw::redis::Error &e)
+            {
+                span.fail();
+                LOG_WARN("记录最近写入的key失败，其它实例短时间内可能从从库读到旧数据：{}", e.what());
+            }
+        }
+        bool contains(const std::vector<std::string_view> &keys) override
+        {
+            ScopedSpan span("redis", "recent_writes.exists");
+            std::vector<std::string> names;
+            names.reserve(keys.size());
+            for (auto key : keys)
+            {
+                names.push_back(name(key));
+            }
+            try
+            {
+                return _redis_client->exists(names.begin(), names.end()) > 0;
+            }
+            catch (const sw::redis::Error &e)
+            {
+                span.fail();
+                LOG_WARN("查询最近写入的key失败，改为读主库：{}", e.what());
+                return true;
+            }
+        }
+
+    private:
+        std::string name(std::string_view key) const
+        {
+            return _prefix + std::string(key);
+        }
+
+    private:
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+        std::string _prefix;
+    };
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <map>
+#include <vector>
+#include <functional>
+#include "instance.hpp"
+
+namespace chat_ns
+{
+    // 前缀查询结果
+    struct ListResult
+    {
+        bool ok = false;
+        std::string error;
+        int64_t revision = 0;                     // 查询时存储的版本号
+        std::map<std::string, std::string> kvs;   // key -> value
+    };
+
+    // 一次监听通知
+    struct WatchResponse
+    {
+        bool ok = false;
+        bool compacted = false;                   // 续接的版本已被压缩，需重新全量查询
+        std::string error;
+        int64_t revision = 0;                     // 本次通知对应的版本号
+        std::vector<ServiceEvent> events;         // 删除事件中value为删除前的值
+    };
+
+    // 一个进行中的监听，析构或cancel后不再回调
+    class RegistryWatch
+    {
+    public:
+        using ptr = std::shared_ptr<RegistryWatch>;
+        virtual ~RegistryWatch() {}
+        virtual void cancel() = 0;
+    };
+
+    // 注册中心存储接口，Registry/Discovery只依赖该接口，实现有etcd(EtcdBackend)与进程内存(MemoryBackend)
+    class RegistryBackend
+    {
+    public:
+        using ptr = std::shared_ptr<RegistryBackend>;
+        using WatchCallback = std::function<void(const WatchResponse &)>;
+        using StopCallback = std::function<void()>;
+        virtual ~RegistryBackend() {}
+
+        // 申请一个ttl秒的租约并自动保活，失败返回0
+        virtual int64_t keepAlive(int ttl) = 0;
+        // 撤销租约，关联的key随之删除
+        virtual void revoke(int64_t lease_id) = 0;
+        // 租约是否仍然有效；保活失败(如隔离超过ttl后租约已被删除)时返回false，需重新申请租约并注册
+        virtual bool leaseAlive(int64_t lease_id) = 0;
+        virtual bool put(const std::string &key, const std::string &value, int64_t lease_id, std::string &error) = 0;
+        virtual bool remove(const std::string &key, std::string &error) = 0;
+        virtual ListResult list(const std::string &prefix) = 0;
+        // 监听prefix下从from_revision(含)开始的变更；监听因错误或连接断开结束时调用on_stopped，主动cancel不调用
+        virtual RegistryWatch::ptr watch(const std::string &prefix, int64_t from_revision,
+                                         const WatchCallback &callback, const StopCallback &on_stopped) = 0;
+    };
+}
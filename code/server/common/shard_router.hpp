@@ -0,0 +1,47 @@
+#pragma once
+#include <butil/third_party/murmurhash3/murmurhash3.h>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // 按key哈希分表：key相同的数据总是落在同一张表中，单个key的查询只访问一张表
+    // 表名为 前缀_两位序号，如messages_07；分表数一旦确定不能修改，否则已有数据的路由会改变
+    class ShardRouter
+    {
+    public:
+        ShardRouter(const std::string &table_prefix, uint32_t shard_count)
+            : _prefix(table_prefix), _shard_count(shard_count == 0 ? 1 : shard_count)
+        {
+            if (_shard_count > 100)
+            {
+                LOG_ERROR("分表数{}超过上限100，按100处理", _shard_count);
+                _shard_count = 100;
+            }
+        }
+        uint32_t shard(std::string_view key) const
+        {
+            uint32_t hash = 0;
+            butil::MurmurHash3_x86_32(key.data(), static_cast<int>(key.size()), 0, &hash);
+            return hash % _shard_count;
+        }
+        std::string table(std::string_view key) const
+        {
+            return table(shard(key));
+        }
+        std::string table(uint32_t shard) const
+        {
+            char suffix[8];
+            snprintf(suffix, sizeof(suffix), "_%02u", shard);
+            return _prefix + suffix;
+        }
+        uint32_t shardCount() const { return _shard_count; }
+
+    private:
+        std::string _prefix;
+        uint32_t _shard_count;
+    };
+}
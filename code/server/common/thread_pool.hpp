@@ -0,0 +1,191 @@
+#pragma once
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <pthread.h>
+#include <sched.h>
+#include <iostream>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace chat_ns
+{
+    // 将当前线程绑定到cpus中的核上，cpus为空时不做处理
+    inline bool bindCurrentThread(const std::vector<int> &cpus)
+    {
+        if (cpus.empty())
+            return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0)
+        {
+            LOG_WARN("绑定线程cpu亲和性失败：{}", ret);
+            return false;
+        }
+        return true;
+    }
+
+    // 执行阻塞任务(磁盘io、第三方同步sdk、数据库等)的独立线程池，避免阻塞bthread工作线程
+    // 在bthread中调用run时只挂起当前bthread，工作线程可以继续调度其它请求
+    class WorkerPool
+    {
+    public:
+        using ptr = std::shared_ptr<WorkerPool>;
+        using Task = std::function<void()>;
+        // max_queue：排队任务数上限，0表示不限制；超出时任务被拒绝，由调用方快速失败
+        WorkerPool(const std::string &name, int32_t threads,
+                   const std::vector<int> &cpus = std::vector<int>(),
+                   size_t max_queue = 0)
+            : _name(name),
+              _cpus(cpus),
+              _max_queue(max_queue),
+              _running(true),
+              _queue_size(queueSize, this)
+        {
+            _queue_size.expose("worker_pool_" + name + "_queue");
+            _active.expose("worker_pool_" + name + "_active");
+            _wait_latency.expose("worker_pool_" + name + "_wait");
+            threads = std::max(1, threads);
+            for (int32_t i = 0; i < threads; i++)
+            {
+                _threads.emplace_back(&WorkerPool::loop, this);
+            }
+            LOG_INFO("阻塞任务线程池{}已启动，线程数：{}", name, threads);
+        }
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            for (auto &thread : _threads)
+            {
+                thread.join();
+            }
+        }
+        // 提交任务后立即返回，线程池已停止或队列已满时返回false
+        bool post(Task task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_running == false)
+                    return false;
+                if (_max_queue > 0 && _tasks.size() >= _max_queue)
+                {
+                    LOG_WARN("线程池{}排队任务已达上限{}，拒绝新任务", _name, _max_queue);
+                    return false;
+                }
+                _tasks.push_back(Item{std::move(task), std::chrono::steady_clock::now()});
+            }
+            _cond.notify_one();
+            return true;
+        }
+        // 提交任务并等待其执行完成，任务被拒绝时返回false
+        bool run(const Task &task)
+        {
+            bthread::CountdownEvent event(1);
+            // 调用方等待任务完成，期间其追踪上下文有效，可直接带入工作线程
+            const TraceContext *ctx = TraceContext::current();
+            bool posted = post([&task, &event, ctx]()
+                               {
+                                   {
+                                       TraceAttach attach(ctx);
+                                       task();
+                                   }
+                                   event.signal(); });
+            if (posted == false)
+                return false;
+            event.wait();
+            return true;
+        }
+        // 并发执行一组任务并等待全部完成，有任务被拒绝时返回false(已提交的任务仍会执行完)
+        bool runAll(const std::vector<Task> &tasks)
+        {
+            if (tasks.empty())
+                return true;
+            bthread::CountdownEvent event(static_cast<int>(tasks.size()));
+            const TraceContext *ctx = TraceContext::current();
+            bool posted = true;
+            for (auto &task : tasks)
+            {
+                if (post([&task, &event, ctx]()
+                         {
+                             {
+                                 TraceAttach attach(ctx);
+                                 task();
+                             }
+                             event.signal(); }) == false)
+                {
+                    posted = false;
+                    event.signal();
+                }
+            }
+            event.wait();
+            return posted;
+        }
+
+    private:
+        struct Item
+        {
+            Task task;
+            std::chrono::steady_clock::time_point enqueue_time;
+        };
+        static size_t queueSize(void *arg)
+        {
+            WorkerPool *pool = static_cast<WorkerPool *>(arg);
+            std::lock_guard<std::mutex> lock(pool->_mutex);
+            return pool->_tasks.size();
+        }
+        void loop()
+        {
+            bindCurrentThread(_cpus);
+            while (true)
+            {
+                Item item;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait(lock, [this]()
+                               { return _running == false || !_tasks.empty(); });
+                    // 停止时仍执行完已排队的任务，避免等待中的调用方永远得不到通知
+                    if (_tasks.empty())
+                        return;
+                    item = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                _wait_latency << std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - item.enqueue_time)
+                                     .count();
+                _active << 1;
+                item.task();
+                _active << -1;
+            }
+        }
+
+    private:
+        std::string _name;
+        std::vector<int> _cpus;
+        size_t _max_queue;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _running;
+        std::deque<Item> _tasks;
+        std::vector<std::thread> _threads;
+        bvar::PassiveStatus<size_t> _queue_size;  // 排队中的任务数
+        bvar::Adder<int32_t> _active;             // 执行中的任务数
+        bvar::LatencyRecorder _wait_latency;      // 任务排队耗时(us)
+    };
+}
@@ -0,0 +1,346 @@
+#pragma once
+#include <brpc/traceprintf.h>
+#include <bthread/bthread.h>
+#include <butil/fast_rand.h>
+#include <butil/third_party/murmurhash3/murmurhash3.h>
+#include <bvar/bvar.h>
+#include <json/json.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <string_view>
+#include <optional>
+#include "logger.hpp"
+
+namespace chat_ns
+{
+    // 链路追踪配置
+    struct TraceOptions
+    {
+        std::string service;        // 写入span的服务名
+        double sample_ratio = 0.01; // 采样比例，按request_id计算，同一请求在各服务中的采样结果一致
+        std::string export_file;    // 采样的span以json lines追加写入该文件，为空则只输出到rpcz
+        size_t max_pending = 65536; // 待写入span数上限，超出时丢弃
+    };
+
+    // 当前bthread(或pthread)所处的追踪上下文，只在请求被采样时存在
+    struct TraceContext
+    {
+        std::string trace_id;     // 32位十六进制，由request_id哈希得到
+        std::string request_id;
+        uint64_t span_id = 0;     // 当前span，作为子span的父span
+
+        static bthread_key_t key()
+        {
+            static bthread_key_t key = []()
+            {
+                bthread_key_t k;
+                bthread_key_create(&k, nullptr);
+                return k;
+            }();
+            return key;
+        }
+        static const TraceContext *current()
+        {
+            return static_cast<const TraceContext *>(bthread_getspecific(key()));
+        }
+        static void setCurrent(const TraceContext *ctx)
+        {
+            bthread_setspecific(key(), const_cast<TraceContext *>(ctx));
+        }
+    };
+
+    // 将追踪上下文带入另一个bthread/线程执行的任务中，ctx需在任务结束前保持有效
+    class TraceAttach
+    {
+    public:
+        TraceAttach(const TraceContext *ctx) : _prev(TraceContext::current())
+        {
+            TraceContext::setCurrent(ctx);
+        }
+        ~TraceAttach()
+        {
+            TraceContext::setCurrent(_prev);
+        }
+
+    private:
+        const TraceContext *_prev;
+    };
+
+    // 已结束的span，导出格式参照OpenTelemetry的span字段
+    struct SpanRecord
+    {
+        std::string trace_id;
+        std::string request_id;
+        uint64_t span_id = 0;
+        uint64_t parent_id = 0;
+        std::string kind; // rpc_server/rpc_client/mysql/redis/es
+        std::string name;
+        int64_t start_ns = 0;
+        int64_t end_ns = 0;
+        bool ok = true;
+    };
+
+    // 采样判定与span导出，后台线程批量写文件，不在请求路径上做io
+    class Tracer
+    {
+    public:
+        static Tracer &instance()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+        void init(const TraceOptions &options)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _options = options;
+            _threshold = static_cast<uint64_t>(std::max(0.0, std::min(1.0, options.sample_ratio)) * 10000);
+            if (!options.export_file.empty() && !_export_thread.joinable())
+                _export_thread = std::thread(&Tracer::exportLoop, this);
+            LOG_INFO("链路追踪：采样比例{}，导出文件{}", options.sample_ratio, options.export_file);
+        }
+        ~Tracer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_export_thread.joinable())
+                _export_thread.join();
+        }
+        // 按request_id计算trace_id并判定是否采样
+        bool sample(const std::string &request_id, std::string &trace_id)
+        {
+            if (_threshold == 0 || request_id.empty())
+                return false;
+            uint64_t hash[2];
+            butil::MurmurHash3_x64_128(request_id.data(), static_cast<int>(request_id.size()), 0, hash);
+            if (hash[0] % 10000 >= _threshold)
+                return false;
+            char buf[33];
+            snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hash[0], (unsigned long long)hash[1]);
+            trace_id = buf;
+            return true;
+        }
+        void record(SpanRecord &&span)
+        {
+            if (_options.export_file.empty())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_pending.size() >= _options.max_pending)
+                {
+                    _dropped << 1;
+                    return;
+                }
+                _pending.push_back(std::move(span));
+            }
+            _cond.notify_one();
+        }
+
+    private:
+        Tracer() : _threshold(0), _running(true)
+        {
+            _dropped.expose("trace_dropped_spans");
+            _exported.expose("trace_exported_spans");
+        }
+        static std::string hex(uint64_t id)
+        {
+            char buf[17];
+            snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)id);
+            return buf;
+        }
+        void exportLoop()
+        {
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "";
+            std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+            std::ofstream file(_options.export_file, std::ios::out | std::ios::app);
+            if (!file.is_open())
+            {
+                LOG_ERROR("打开链路追踪导出文件{}失败", _options.export_file);
+                return;
+            }
+            while (true)
+            {
+                std::deque<SpanRecord> spans;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait_for(lock, std::chrono::milliseconds(200), [this]()
+                                   { return _running == false || _pending.size() >= 256; });
+                    spans.swap(_pending);
+                    if (_running == false && spans.empty())
+                        return;
+                }
+                for (auto &span : spans)
+                {
+                    Json::Value root;
+                    root["traceId"] = span.trace_id;
+                    root["spanId"] = hex(span.span_id);
+                    if (span.parent_id != 0)
+                        root["parentSpanId"] = hex(span.parent_id);
+                    root["name"] = span.name;
+                    root["kind"] = span.kind;
+                    root["startTimeUnixNano"] = Json::Int64(span.start_ns);
+                    root["endTimeUnixNano"] = Json::Int64(span.end_ns);
+                    root["status"] = span.ok ? "OK" : "ERROR";
+                    root["attributes"]["service"] = _options.service;
+                    root["attributes"]["request_id"] = span.request_id;
+                    writer->write(root, &file);
+                    file << '\n';
+                }
+                file.flush();
+                _exported << spans.size();
+            }
+        }
+
+    private:
+        TraceOptions _options;
+        uint64_t _threshold; // 采样阈值(万分比)
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _running;
+        std::deque<SpanRecord> _pending;
+        std::thread _export_thread;
+        bvar::Adder<int64_t> _dropped;  // 队列满丢弃的span数
+        bvar::Adder<int64_t> _exported; // 已写入文件的span数
+    };
+
+    // 一段被追踪的操作：
+    // 1. 开启rpcz时，结束时通过TRACEPRINTF在当前rpc的rpcz span中记录耗时
+    // 2. 请求被采样时，生成子span并导出；未采样时只有一次线程局部变量读取的开销
+    // attach为true时在存续期间作为当前上下文，其中发起的操作成为其子span；异步操作传false
+    // 父上下文的信息在构造时复制：异步span可能在发起方的栈帧退出之后才在其它bthread中结束
+    class ScopedSpan
+    {
+    public:
+        ScopedSpan(const char *kind, std::string_view name, bool attach = true)
+            : _kind(kind),
+              _prev(nullptr),
+              _parent_id(0),
+              _traced(false),
+              _annotate(brpc::CanAnnotateSpan()),
+              _attached(false),
+              _ok(true),
+              _ended(false)
+        {
+            const TraceContext *parent = TraceContext::current();
+            _traced = parent != nullptr;
+            if (_traced == false && _annotate == false)
+                return;
+            _name.assign(name.data(), name.size());
+            _start = std::chrono::steady_clock::now();
+            _start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+            if (_traced == false)
+                return;
+            _ctx.trace_id = parent->trace_id;
+            _ctx.request_id = parent->request_id;
+            _ctx.span_id = butil::fast_rand();
+            _parent_id = parent->span_id;
+            if (attach)
+            {
+                // 同步span在发起方的作用域内结束，结束时恢复为父上下文
+                _prev = parent;
+                TraceContext::setCurrent(&_ctx);
+                _attached = true;
+            }
+        }
+        ~ScopedSpan()
+        {
+            end();
+        }
+        void fail()
+        {
+            _ok = false;
+        }
+        void end()
+        {
+            if (_ended)
+                return;
+            _ended = true;
+            if (_traced == false && _annotate == false)
+                return;
+            int64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - _start)
+                                     .count();
+            if (_annotate)
+                TRACEPRINTF("%s %s %s %ldus", _kind, _name.c_str(), _ok ? "ok" : "failed", (long)(elapsed_ns / 1000));
+            if (_traced == false)
+                return;
+            if (_attached)
+                TraceContext::setCurrent(_prev);
+            SpanRecord span;
+            span.trace_id = _ctx.trace_id;
+            span.request_id = _ctx.request_id;
+            span.span_id = _ctx.span_id;
+            span.parent_id = _parent_id;
+            span.kind = _kind;
+            span.name = _name;
+            span.start_ns = _start_ns;
+            span.end_ns = _start_ns + elapsed_ns;
+            span.ok = _ok;
+            Tracer::instance().record(std::move(span));
+        }
+
+    private:
+        const char *_kind;
+        std::string _name;
+        const TraceContext *_prev; // attach时被替换的当前上下文，只在同步结束时用于恢复，不读取其内容
+        uint64_t _parent_id;       // 父span的id
+        bool _traced;              // 构造时是否处于被采样的请求中
+        bool _annotate;
+        bool _attached;
+        bool _ok;
+        bool _ended;
+        TraceContext _ctx;
+        std::chrono::steady_clock::time_point _start;
+        int64_t _start_ns = 0;
+    };
+
+    // rpc服务端入口：按request_id决定是否采样，被采样时作为根span，期间发起的操作都记录为其子span
+    class TraceScope
+    {
+    public:
+        TraceScope(const std::string &request_id, std::string_view method)
+            : _prev(TraceContext::current())
+        {
+            if (Tracer::instance().sample(request_id, _root.trace_id))
+            {
+                _root.request_id = request_id;
+                TraceContext::setCurrent(&_root);
+            }
+            else if (_prev != nullptr)
+            {
+                TraceContext::setCurrent(nullptr);
+            }
+            _span.emplace("rpc_server", method);
+        }
+        ~TraceScope()
+        {
+            _span.reset();
+            if (TraceContext::current() != _prev)
+                TraceContext::setCurrent(_prev);
+        }
+        void fail()
+        {
+            _span->fail();
+        }
+
+    private:
+        const TraceContext *_prev;
+        TraceContext _root;
+        std::optional<ScopedSpan> _span;
+    };
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <brpc/server.h>
+#include <unistd.h>
+#include <memory>
+#include "logger.hpp"
+#include "concurrency.hpp"
+
+namespace chat_ns
+{
+    // 在unix域套接字上再提供一份rpc服务，供同机的调用方绕过tcp回环访问
+    // service由tcp服务器持有，这里不接管其生命周期；失败返回空
+    inline std::shared_ptr<brpc::Server> startUnixServer(google::protobuf::Service *service,
+                                                         const std::string &unix_path,
+                                                         const brpc::ServerOptions &options,
+                                                         const ConcurrencyOptions &concurrency = ConcurrencyOptions())
+    {
+        // 清理上次进程异常退出遗留的套接字文件，否则无法监听
+        unlink(unix_path.c_str());
+        auto server = std::make_shared<brpc::Server>();
+        int ret = server->AddService(service, brpc::ServiceOwnership::SERVER_DOESNT_OWN_SERVICE);
+        if (ret == -1)
+        {
+            LOG_ERROR("unix域套接字服务器添加Rpc服务失败！");
+            return nullptr;
+        }
+        if (applyMethodConcurrency(*server, service, concurrency) == false)
+            return nullptr;
+        std::string endpoint = "unix:" + unix_path;
+        ret = server->Start(endpoint.c_str(), &options);
+        if (ret == -1)
+        {
+            LOG_ERROR("unix域套接字服务器在{}启动失败！", unix_path);
+            return nullptr;
+        }
+        LOG_INFO("unix域套接字服务器已在{}启动", unix_path);
+        return server;
+    }
+}
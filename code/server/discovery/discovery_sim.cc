@@ -0,0 +1,225 @@
+// 服务注册发现的单机模拟：以MemoryRegistry代替etcd，在一个进程内运行多个服务实例的Registry与一个调用方的
+// Discovery/ServiceManager，依次注入实例上下线、网络隔离、历史压缩、租约到期等场景，检查调用方的路由表能否收敛，
+// 最后统计就近路由的流量分布与choose的吞吐。不依赖etcd与下游服务，任一场景失败时以非0状态退出
+#include <gflags/gflags.h>
+#include <sstream>
+#include <map>
+#include <set>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include "../common/logger.hpp"
+#include "../common/etcd.hpp"
+#include "../common/channel.hpp"
+#include "../common/memory_registry.hpp"
+
+DEFINE_int32(log_level, 3, "日志等级，0~6依次为trace/debug/info/warn/error/critical/off");
+DEFINE_int32(latency, 20, "注册中心监听通知的送达延迟(ms)");
+DEFINE_int32(ttl, 1, "实例租约时长(s)");
+DEFINE_int32(debounce, 50, "服务发现事件合并窗口(ms)");
+DEFINE_int32(converge_timeout, 5000, "等待路由表收敛的最长时间(ms)");
+DEFINE_int32(picks, 20000, "统计流量分布时的选择次数");
+DEFINE_int32(threads, 8, "测量choose吞吐的并发线程数");
+DEFINE_int32(bench_picks, 1000000, "测量choose吞吐时每个线程的选择次数");
+
+namespace
+{
+    const std::string kBaseDir = "/service";
+    const std::string kService = "/service/user_service";
+
+    int g_failures = 0;
+    void check(bool ok, const std::string &scenario)
+    {
+        printf("[%s] %s\n", ok ? "PASS" : "FAIL", scenario.c_str());
+        if (ok == false)
+            g_failures++;
+    }
+
+    // 一个模拟的服务实例：独立的注册中心客户端，注册信息中的地址不需要真实监听
+    struct Instance
+    {
+        std::string key;
+        chat_ns::InstanceMeta meta;
+        chat_ns::Registry::ptr registry;
+    };
+    std::shared_ptr<Instance> startInstance(const chat_ns::MemoryRegistry::ptr &store, int32_t index,
+                                            const std::string &zone, const std::string &machine)
+    {
+        auto instance = std::make_shared<Instance>();
+        std::string client = "instance-" + std::to_string(index);
+        instance->key = kService + "/instance-" + std::to_string(index);
+        instance->meta.host = "127.0.0.1:" + std::to_string(20000 + index);
+        instance->meta.zone = zone;
+        instance->meta.machine = machine;
+        instance->registry = std::make_shared<chat_ns::Registry>(store->connect(client), FLAGS_ttl);
+        instance->registry->registry(instance->key, instance->meta);
+        return instance;
+    }
+
+    // 从brpc信道的描述"Channel[ip:port]"中取出节点地址
+    std::string channelHost(const chat_ns::ServiceManager::ChannelPtr &channel)
+    {
+        std::ostringstream os;
+        channel->Describe(os, brpc::DescribeOptions());
+        std::string desc = os.str();
+        auto begin = desc.find('[');
+        auto end = desc.rfind(']');
+        if (begin == std::string::npos || end == std::string::npos || end <= begin)
+            return desc;
+        return desc.substr(begin + 1, end - begin - 1);
+    }
+    // 选择picks次，返回各节点被选中的次数
+    std::map<std::string, int32_t> route(const chat_ns::ServiceManager::ptr &manager, int32_t picks)
+    {
+        std::map<std::string, int32_t> hits;
+        for (int32_t i = 0; i < picks; i++)
+        {
+            auto channel = manager->choose(kService);
+            if (!channel)
+                break;
+            hits[channelHost(channel)]++;
+        }
+        return hits;
+    }
+    std::set<std::string> routedHosts(const chat_ns::ServiceManager::ptr &manager)
+    {
+        std::set<std::string> hosts;
+        for (auto &[host, count] : route(manager, 200))
+        {
+            hosts.insert(host);
+        }
+        return hosts;
+    }
+    // 等待调用方的路由表恰好包含expected中的节点
+    bool converge(const chat_ns::ServiceManager::ptr &manager, const std::set<std::string> &expected)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLAGS_converge_timeout);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            if (routedHosts(manager) == expected)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        return false;
+    }
+    std::set<std::string> hostsOf(const std::vector<std::shared_ptr<Instance>> &instances)
+    {
+        std::set<std::string> hosts;
+        for (auto &instance : instances)
+        {
+            hosts.insert(instance->meta.host);
+        }
+        return hosts;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    chat_ns::logger::initLogger(false, "", 0);
+    chat_ns::logger::g_default_logger->set_level((spdlog::level::level_enum)FLAGS_log_level);
+
+    auto store = std::make_shared<chat_ns::MemoryRegistry>(FLAGS_latency);
+    auto manager = std::make_shared<chat_ns::ServiceManager>();
+    manager->setLocality(chat_ns::Locality{"zone-a", "machine-a"});
+    manager->declared(kService);
+    auto discovery = std::make_shared<chat_ns::Discovery>(
+        store->connect("caller"), kBaseDir,
+        std::bind(&chat_ns::ServiceManager::onServiceBatch, manager.get(), std::placeholders::_1),
+        "", FLAGS_debounce);
+
+    // 1. 实例陆续上线
+    std::vector<std::shared_ptr<Instance>> instances;
+    for (int32_t i = 0; i < 3; i++)
+    {
+        instances.push_back(startInstance(store, i, "zone-b", "machine-b"));
+    }
+    check(converge(manager, hostsOf(instances)), "3个实例上线后全部进入路由表");
+
+    // 2. 实例主动下线
+    instances.back()->registry->deregister();
+    instances.pop_back();
+    check(converge(manager, hostsOf(instances)), "实例注销后立即从路由表删除");
+
+    // 3. 实例与注册中心隔离，租约到期后被删除；恢复后原Registry自行申请新租约并重新注册
+    store->partition("instance-1", true);
+    auto isolated = instances.back();
+    instances.pop_back();
+    check(converge(manager, hostsOf(instances)), "实例隔离超过租约时长后从路由表删除");
+    store->partition("instance-1", false);
+    instances.push_back(isolated);
+    check(converge(manager, hostsOf(instances)), "隔离恢复后原实例以新租约重新注册");
+
+    // 4. 调用方与注册中心隔离：隔离期间的变更在恢复后从断开处的版本续接
+    store->partition("caller", true);
+    instances.push_back(startInstance(store, 3, "zone-b", "machine-b"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    store->partition("caller", false);
+    check(converge(manager, hostsOf(instances)), "调用方恢复连接后续接监听，补齐隔离期间的变更");
+
+    // 5. 调用方断开期间历史被压缩：续接失败，重新全量拉取并比对差异
+    store->partition("caller", true);
+    instances.front()->registry->deregister();
+    instances.erase(instances.begin());
+    instances.push_back(startInstance(store, 4, "zone-b", "machine-b"));
+    store->compact(store->revision());
+    store->partition("caller", false);
+    check(converge(manager, hostsOf(instances)), "续接的版本已被压缩时重新拉取全量信息");
+
+    // 6. 就近路由：本机实例按其剩余容量能承载的比例接收流量，其余溢出到其它实例
+    instances.push_back(startInstance(store, 5, "zone-a", "machine-a"));
+    check(converge(manager, hostsOf(instances)), "本机实例上线");
+    const std::string local = instances.back()->meta.host;
+    auto localShare = [&]()
+    {
+        auto hits = route(manager, FLAGS_picks);
+        return (double)hits[local] / FLAGS_picks;
+    };
+    // 4个实例权重相同时本机权重占比0.25，不低于locality_share(0.2)，本机流量全部留在本机
+    double idle_share = localShare();
+    check(idle_share > 0.99, "本机实例空闲时本机流量全部留在本机(实际" + std::to_string(idle_share) + ")");
+    // cpu使用率0.8时本机有效权重20，占比20/320，留在本机的比例为(20/320)/0.2=0.3125
+    auto &loaded = instances.back();
+    loaded->meta.load.cpu = 0.8;
+    loaded->registry->registry(loaded->key, loaded->meta);
+    double expected = (20.0 / 320) / chat_ns::ServiceChannelOptions().locality_share;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLAGS_converge_timeout);
+    double loaded_share = localShare();
+    while (std::abs(loaded_share - expected) > 0.05 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        loaded_share = localShare();
+    }
+    check(std::abs(loaded_share - expected) <= 0.05,
+          "本机实例负载升高后按比例溢出(期望" + std::to_string(expected) + "，实际" + std::to_string(loaded_share) + ")");
+
+    // 7. choose的吞吐
+    std::vector<std::thread> threads;
+    std::atomic<int64_t> failed(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t t = 0; t < FLAGS_threads; t++)
+    {
+        threads.emplace_back([&]()
+                             {
+            for (int32_t i = 0; i < FLAGS_bench_picks; i++)
+            {
+                if (!manager->choose(kService))
+                    failed++;
+            } });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int64_t total = (int64_t)FLAGS_threads * FLAGS_bench_picks;
+    printf("choose threads=%d qps=%.0f avg=%.0fns failed=%ld\n", FLAGS_threads, total / seconds,
+           seconds * 1e9 * FLAGS_threads / total, (long)failed.load());
+    check(failed.load() == 0, "并发选择节点全部成功");
+
+    discovery.reset();
+    instances.clear();
+    printf("%d个场景失败\n", g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
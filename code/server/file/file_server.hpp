@@ -2,7 +2,14 @@
 #include <butil/logging.h>
 #include "../common/asr.hpp"
 #include "../common/etcd.hpp"
+#include "../common/load.hpp"
+#include "../common/drain.hpp"
+#include "../common/unix_server.hpp"
+#include "../common/concurrency.hpp"
+#include "../common/bootstrap.hpp"
+#include "../common/thread_pool.hpp"
 #include "../common/logger.hpp"
+#include "../common/trace.hpp"
 #include "../common/utils.hpp"
 #include "../proto/cpp_out/base.pb.h"
 #include "../proto/cpp_out/file.pb.h"
@@ -13,7 +20,9 @@ namespace chat_ns
     class FileServiceImpl : public chat_ns::FileService
     {
     public:
-        FileServiceImpl(const std::string &storage_path) : _storage_path(storage_path)
+        FileServiceImpl(const std::string &storage_path,
+                        const WorkerPool::ptr &io_pool = nullptr) : _storage_path(storage_path),
+                                                                    _io_pool(io_pool)
         {
             umask(0);
             mkdir(storage_path.c_str(), 0775);
@@ -27,13 +36,14 @@ namespace chat_ns
                            ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "FileService.GetSingleFile");
             response->set_request_id(request->request_id());
             // 1. 取出请求中的文件ID（起始就是文件名）
             std::string fid = request->file_id();
             std::string filename = _storage_path + fid;
             // 2. 将文件ID作为文件名，读取文件数据
             std::string body;
-            bool ret = chat_ns::Utils::readFile(filename, body);
+            bool ret = readFile(filename, body);
             if (ret == false)
             {
                 response->set_success(false);
@@ -52,6 +62,7 @@ namespace chat_ns
                           ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "FileService.GetMultiFile");
             response->set_request_id(request->request_id());
             // 循环取出请求中的文件ID，读取文件数据进行填充
             for (int i = 0; i < request->file_id_list_size(); i++)
@@ -59,7 +70,7 @@ namespace chat_ns
                 std::string fid = request->file_id_list(i);
                 std::string filename = _storage_path + fid;
                 std::string body;
-                bool ret = chat_ns::Utils::readFile(filename, body);
+                bool ret = readFile(filename, body);
                 if (ret == false)
                 {
                     response->set_success(false);
@@ -80,12 +91,13 @@ namespace chat_ns
                            ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "FileService.PutSingleFile");
             response->set_request_id(request->request_id());
             // 1. 为文件生成一个唯一uuid作为文件名 以及 文件ID
             std::string fid = chat_ns::Utils::uuid();
             std::string filename = _storage_path + fid;
             // 2. 取出请求中的文件数据，进行文件数据写入
-            bool ret = chat_ns::Utils::writeFile(filename, request->file_data().file_content());
+            bool ret = writeFile(filename, request->file_data().file_content());
             if (ret == false)
             {
                 response->set_success(false);
@@ -105,12 +117,13 @@ namespace chat_ns
                           ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "FileService.PutMultiFile");
             response->set_request_id(request->request_id());
             for (int i = 0; i < request->file_data_size(); i++)
             {
                 std::string fid = chat_ns::Utils::uuid();
                 std::string filename = _storage_path + fid;
-                bool ret = chat_ns::Utils::writeFile(filename, request->file_data(i).file_content());
+                bool ret = writeFile(filename, request->file_data(i).file_content());
                 if (ret == false)
                 {
                     response->set_success(false);
@@ -126,8 +139,32 @@ namespace chat_ns
             response->set_success(true);
         }
 
+    private:
+        // 文件读写在阻塞任务线程池中执行，不占用bthread工作线程
+        bool readFile(const std::string &filename, std::string &body)
+        {
+            bool ret = false;
+            if (!_io_pool)
+                return chat_ns::Utils::readFile(filename, body);
+            if (_io_pool->run([&]()
+                              { ret = chat_ns::Utils::readFile(filename, body); }) == false)
+                return false;
+            return ret;
+        }
+        bool writeFile(const std::string &filename, const std::string &body)
+        {
+            bool ret = false;
+            if (!_io_pool)
+                return chat_ns::Utils::writeFile(filename, body);
+            if (_io_pool->run([&]()
+                              { ret = chat_ns::Utils::writeFile(filename, body); }) == false)
+                return false;
+            return ret;
+        }
+
     private:
         std::string _storage_path;
+        WorkerPool::ptr _io_pool;
     };
 
     class FileServer
@@ -135,18 +172,24 @@ namespace chat_ns
     public:
         using ptr = std::shared_ptr<FileServer>;
         FileServer(const Registry::ptr &reg_client,
-                   const std::shared_ptr<brpc::Server> &server) : _reg_client(reg_client),
-                                                                  _rpc_server(server) {}
+                   const std::shared_ptr<brpc::Server> &server,
+                   const std::shared_ptr<brpc::Server> &unix_server = nullptr) : _reg_client(reg_client),
+                                                                                 _rpc_server(server),
+                                                                                 _unix_server(unix_server) {}
         ~FileServer() {}
-        // 搭建RPC服务器，并启动服务器
-        void start()
+        // 搭建RPC服务器，并启动服务器；收到退出信号后优雅下线
+        void start(const DrainOptions &drain_options = DrainOptions())
         {
-            _rpc_server->RunUntilAskedToQuit();
+            std::vector<std::shared_ptr<brpc::Server>> servers{_rpc_server};
+            if (_unix_server)
+                servers.push_back(_unix_server);
+            runUntilDrained(servers, _reg_client, drain_options);
         }
 
     private:
         Registry::ptr _reg_client;
         std::shared_ptr<brpc::Server> _rpc_server;
+        std::shared_ptr<brpc::Server> _unix_server;
     };
 
     class FileServerBuilder
@@ -155,34 +198,53 @@ namespace chat_ns
         // 用于构造服务注册客户端对象
         void make_reg_object(const std::string &reg_host,
                              const std::string &service_name,
-                             const std::string &access_host)
+                             const InstanceMeta &meta,
+                             int ttl = 3,
+                             const LoadReportOptions &load_options = LoadReportOptions())
         {
-            _reg_client = std::make_shared<Registry>(reg_host);
-            _reg_client->registry(service_name, access_host);
+            _reg_client = std::make_shared<Registry>(reg_host, ttl);
+            _load_report_options = load_options;
+            _reg_client->registry(service_name, meta);
         }
         // 构造RPC服务器对象
-        void make_rpc_server(uint16_t port, int32_t timeout,
-                             uint8_t num_threads, const std::string &path = "./data/")
+        // io_pool非空时文件读写在该线程池中执行
+        void make_rpc_server(const RpcServerOptions &rpc_options,
+                             const std::string &path = "./data/",
+                             const WorkerPool::ptr &io_pool = nullptr)
         {
             _rpc_server = std::make_shared<brpc::Server>();
-            FileServiceImpl *file_service = new FileServiceImpl(path);
-            int ret = _rpc_server->AddService(file_service,
+            _file_service = new FileServiceImpl(path, io_pool);
+            int ret = _rpc_server->AddService(_file_service,
                                               brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
                 LOG_ERROR("添加Rpc服务失败！");
                 abort();
             }
-            brpc::ServerOptions options;
-            options.idle_timeout_sec = timeout;
-            options.num_threads = num_threads;
-            ret = _rpc_server->Start(port, &options);
+            if (applyMethodConcurrency(*_rpc_server, _file_service, rpc_options.concurrency) == false)
+                abort();
+            _concurrency = rpc_options.concurrency;
+            _server_options = rpc_options.toServerOptions();
+            ret = _rpc_server->Start(rpc_options.port, &_server_options);
             if (ret == -1)
             {
                 LOG_ERROR("服务启动失败！");
                 abort();
             }
         }
+        // 构造unix域套接字上的RPC服务器，供同机的调用方使用，需在make_rpc_server之后调用
+        // 注册信息中的unix_path需与此处一致，调用方才会改走该套接字
+        void make_unix_server(const std::string &unix_path)
+        {
+            if (!_rpc_server)
+            {
+                LOG_ERROR("还未初始化RPC服务器模块！");
+                abort();
+            }
+            _unix_server = startUnixServer(_file_service, unix_path, _server_options, _concurrency);
+            if (!_unix_server)
+                abort();
+        }
         FileServer::ptr build()
         {
             if (!_reg_client)
@@ -195,13 +257,20 @@ namespace chat_ns
                 LOG_ERROR("还未初始化RPC服务器模块！");
                 abort();
             }
-            FileServer::ptr server = std::make_shared<FileServer>(_reg_client, _rpc_server);
+            // 定期上报本实例负载，供调用方按剩余容量分配流量
+            _reg_client->startLoadReport(ServerLoadSampler(_rpc_server->listen_address().port), _load_report_options);
+            FileServer::ptr server = std::make_shared<FileServer>(_reg_client, _rpc_server, _unix_server);
             return server;
         }
 
     private:
         Registry::ptr _reg_client;
+        LoadReportOptions _load_report_options;
+        FileServiceImpl *_file_service = nullptr;   // 由_rpc_server持有
+        brpc::ServerOptions _server_options;
+        ConcurrencyOptions _concurrency;
         std::shared_ptr<brpc::Server> _rpc_server;
+        std::shared_ptr<brpc::Server> _unix_server;
     };
 
 }
\ No newline at end of file
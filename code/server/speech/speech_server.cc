@@ -1,27 +1,16 @@
 #include "speech_server.hpp"
 
-DEFINE_bool(run_mode, false, "程序的运行模式，false-调试； true-发布；");
-DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
-DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
-
-DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
-DEFINE_string(base_service, "/service", "服务监控根目录");
-DEFINE_string(instance_name, "/speech_service/instance", "当前实例名称");
-DEFINE_string(access_host, "127.0.0.1:10001", "当前实例的外部访问地址");
-
-DEFINE_int32(listen_port, 10001, "Rpc服务器监听端口");
-DEFINE_int32(rpc_timeout, -1, "Rpc调用超时时间");
-DEFINE_int32(rpc_threads, 1, "Rpc的IO线程数量");
+CHAT_DEFINE_SERVER_FLAGS("/speech_service/instance", "127.0.0.1:10001", 10001);
 
 int main(int argc, char *argv[])
 {
-    google::ParseCommandLineFlags(&argc, &argv, true);
-    chat_ns::logger::initLogger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    chat_ns::BootstrapOptions options = chat_ns::bootstrap(argc, argv);
 
     chat_ns::SpeechServerBuilder ssb;
-    ssb.makeRpcServer(FLAGS_listen_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
-    ssb.makeRegObject(FLAGS_registry_host, FLAGS_base_service + FLAGS_instance_name, FLAGS_access_host);
+    auto asr_pool = std::make_shared<chat_ns::WorkerPool>("speech_asr", options.threads.blocking_threads, options.threads.cpus);
+    ssb.makeRpcServer(options.rpc, asr_pool);
+    ssb.makeRegObject(options.registry_host, options.instance_key, options.meta, options.registry_ttl, options.load_report);
     auto server = ssb.build();
-    server->start();
+    server->start(options.drain);
     return 0;
-}
\ No newline at end of file
+}
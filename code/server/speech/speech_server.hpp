@@ -2,13 +2,20 @@
 #include <butil/logging.h>
 #include "../common/asr.hpp"
 #include "../common/etcd.hpp"
+#include "../common/load.hpp"
+#include "../common/drain.hpp"
+#include "../common/concurrency.hpp"
+#include "../common/bootstrap.hpp"
+#include "../common/thread_pool.hpp"
 #include "../common/logger.hpp"
+#include "../common/trace.hpp"
 #include "../proto/cpp_out/speech.pb.h"
 namespace chat_ns
 {
     class SpeechServiceImpl : public chat_ns::SpeechService
     {
     public:
+        SpeechServiceImpl(const WorkerPool::ptr &asr_pool = nullptr) : _asr_pool(asr_pool) {}
         void SpeechRecognition(google::protobuf::RpcController *controller,
                                const ::chat_ns::SpeechRecognitionReq *request,
                                ::chat_ns::SpeechRecognitionRsp *response,
@@ -16,10 +23,16 @@ namespace chat_ns
         {
             LOG_DEBUG("收到语音转文字请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "SpeechService.SpeechRecognition");
             // 1. 取出请求中的语音数据
             // 2. 调用语音sdk模块进行语音识别，得到响应
 
-            std::string res = ASR(request->speech_content()).tostr();
+            std::string res;
+            if (!_asr_pool)
+                res = ASR(request->speech_content()).tostr();
+            else if (_asr_pool->run([&]()
+                                    { res = ASR(request->speech_content()).tostr(); }) == false)
+                LOG_WARN("{} 语音识别任务被拒绝！", request->request_id());
             if (res.empty())
             {
                 LOG_ERROR("{} 语音识别失败！", request->request_id());
@@ -33,6 +46,9 @@ namespace chat_ns
             response->set_success(true);
             response->set_recognition_result(res);
         }
+
+    private:
+        WorkerPool::ptr _asr_pool;
     };
 
     class SpeechServer
@@ -45,10 +61,10 @@ namespace chat_ns
             : _reg_client(reg_client),
               _rpc_server(server) {}
         ~SpeechServer() {}
-        // 搭建RPC服务器，并启动服务器
-        void start()
+        // 搭建RPC服务器，并启动服务器；收到退出信号后优雅下线
+        void start(const DrainOptions &drain_options = DrainOptions())
         {
-            _rpc_server->RunUntilAskedToQuit();
+            runUntilDrained(_rpc_server, _reg_client, drain_options);
         }
 
     private:
@@ -62,26 +78,30 @@ namespace chat_ns
         // 用于构造服务注册客户端对象
         void makeRegObject(const std::string &reg_host,
                              const std::string &service_name,
-                             const std::string &access_host)
+                             const InstanceMeta &meta,
+                             int ttl = 3,
+                             const LoadReportOptions &load_options = LoadReportOptions())
         {
-            _reg_client = std::make_shared<Registry>(reg_host);
-            _reg_client->registry(service_name, access_host);
+            _reg_client = std::make_shared<Registry>(reg_host, ttl);
+            _load_report_options = load_options;
+            _reg_client->registry(service_name, meta);
         }
         // 构造RPC服务器对象
-        void makeRpcServer(uint16_t port, int32_t timeout, uint8_t num_threads)
+        // asr_pool非空时语音识别(同步http调用)在该线程池中执行
+        void makeRpcServer(const RpcServerOptions &rpc_options, const WorkerPool::ptr &asr_pool = nullptr)
         {
             _rpc_server = std::make_shared<brpc::Server>();
-            SpeechServiceImpl *speech_service = new SpeechServiceImpl();
+            SpeechServiceImpl *speech_service = new SpeechServiceImpl(asr_pool);
             int ret = _rpc_server->AddService(speech_service,brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
                 LOG_ERROR("添加Rpc服务失败！");
                 abort();
             }
-            brpc::ServerOptions options;
-            options.idle_timeout_sec = timeout;
-            options.num_threads = num_threads;
-            ret = _rpc_server->Start(port, &options);
+            if (applyMethodConcurrency(*_rpc_server, speech_service, rpc_options.concurrency) == false)
+                abort();
+            brpc::ServerOptions options = rpc_options.toServerOptions();
+            ret = _rpc_server->Start(rpc_options.port, &options);
             if (ret == -1)
             {
                 LOG_ERROR("服务启动失败！");
@@ -100,6 +120,8 @@ namespace chat_ns
                 LOG_ERROR("还未初始化RPC服务器模块！");
                 abort();
             }
+            // 定期上报本实例负载，供调用方按剩余容量分配流量
+            _reg_client->startLoadReport(ServerLoadSampler(_rpc_server->listen_address().port), _load_report_options);
             SpeechServer::ptr server = std::make_shared<SpeechServer>(
                 _reg_client, _rpc_server);
             return server;
@@ -107,6 +129,7 @@ namespace chat_ns
 
     private:
         Registry::ptr _reg_client;
+        LoadReportOptions _load_report_options;
         std::shared_ptr<brpc::Server> _rpc_server;
     };
 }
\ No newline at end of file
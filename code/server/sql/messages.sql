@@ -1,25 +1,101 @@
-
-
 CREATE DATABASE IF NOT EXISTS `chat`;
 USE `chat`;
 DROP TABLE IF EXISTS `messages`;
 
-CREATE TABLE `messages` (
-  `id` BIGINT UNSIGNED NOT NULL PRIMARY KEY AUTO_INCREMENT,
-  `message_id` varchar(64) NOT NULL,
-  `session_id` varchar(64) NOT NULL,
-  `user_id` varchar(64) NOT NULL,
-  `message_type` TINYINT UNSIGNED NOT NULL,
-  `create_time` TIMESTAMP NULL,
-  `content` TEXT NULL,
-  `file_id` varchar(64) NULL,
-  `file_name` varchar(128) NULL,
-  `file_size` INT UNSIGNED NULL)
- ENGINE=InnoDB;
-
-CREATE UNIQUE INDEX `message_id_i`
-  ON `messages` (`message_id`);
-
-CREATE INDEX `session_id_i`
-  ON `messages` (`session_id`);
+-- 消息表按session_id哈希分为messages_00 ~ messages_NN，与ShardRouter的路由规则一致；
+-- 每张分表按create_time按月分区，按时间范围查询历史消息时只扫描相关月份的分区。
+-- 分区表的主键/唯一索引必须包含分区列，因此主键为(id, create_time)，消息id的唯一索引为(message_id, create_time)：
+-- 同一条消息重复写入时create_time相同，仍会被唯一索引拒绝
+
+DROP PROCEDURE IF EXISTS `create_message_shards`;
+DROP PROCEDURE IF EXISTS `add_message_partitions`;
+
+DELIMITER $$
+
+-- 创建shard_count张分表，分区覆盖从当前月份开始的months个月，之后的数据落入p_max
+CREATE PROCEDURE `create_message_shards`(IN shard_count INT, IN months INT)
+BEGIN
+  DECLARE shard INT DEFAULT 0;
+  DECLARE month_index INT DEFAULT 0;
+  DECLARE month_start DATE;
+  DECLARE partition_list TEXT;
+  DECLARE shard_table VARCHAR(64);
+
+  SET partition_list = '';
+  SET month_start = DATE_FORMAT(CURDATE(), '%Y-%m-01');
+  WHILE month_index < months DO
+    SET partition_list = CONCAT(partition_list,
+      'PARTITION p', DATE_FORMAT(month_start, '%Y%m'),
+      ' VALUES LESS THAN (UNIX_TIMESTAMP(''', DATE_ADD(month_start, INTERVAL 1 MONTH), ''')), ');
+    SET month_start = DATE_ADD(month_start, INTERVAL 1 MONTH);
+    SET month_index = month_index + 1;
+  END WHILE;
+  SET partition_list = CONCAT(partition_list, 'PARTITION p_max VALUES LESS THAN MAXVALUE');
+
+  WHILE shard < shard_count DO
+    SET shard_table = CONCAT('messages_', LPAD(shard, 2, '0'));
+    SET @drop_sql = CONCAT('DROP TABLE IF EXISTS `', shard_table, '`');
+    PREPARE stmt FROM @drop_sql;
+    EXECUTE stmt;
+    DEALLOCATE PREPARE stmt;
+
+    SET @create_sql = CONCAT('CREATE TABLE `', shard_table, '` (',
+      '`id` BIGINT UNSIGNED NOT NULL AUTO_INCREMENT,',
+      '`message_id` varchar(64) NOT NULL,',
+      '`session_id` varchar(64) NOT NULL,',
+      '`user_id` varchar(64) NOT NULL,',
+      '`message_type` TINYINT UNSIGNED NOT NULL,',
+      '`create_time` TIMESTAMP NOT NULL,',
+      '`content` TEXT NULL,',
+      '`file_id` varchar(64) NULL,',
+      '`file_name` varchar(128) NULL,',
+      '`file_size` INT UNSIGNED NULL,',
+      'PRIMARY KEY (`id`, `create_time`),',
+      'UNIQUE INDEX `message_id_i` (`message_id`, `create_time`),',
+      'INDEX `session_time_i` (`session_id`, `create_time`))',
+      ' ENGINE=InnoDB',
+      ' PARTITION BY RANGE (UNIX_TIMESTAMP(`create_time`)) (', partition_list, ')');
+    PREPARE stmt FROM @create_sql;
+    EXECUTE stmt;
+    DEALLOCATE PREPARE stmt;
+    SET shard = shard + 1;
+  END WHILE;
+END$$
+
+-- 为每张分表补齐到当前月份之后months个月的分区，由定时任务每月执行一次；已存在的月份跳过
+CREATE PROCEDURE `add_message_partitions`(IN shard_count INT, IN months INT)
+BEGIN
+  DECLARE shard INT DEFAULT 0;
+  DECLARE month_index INT;
+  DECLARE month_start DATE;
+  DECLARE shard_partition VARCHAR(16);
+  DECLARE shard_table VARCHAR(64);
+
+  WHILE shard < shard_count DO
+    SET shard_table = CONCAT('messages_', LPAD(shard, 2, '0'));
+    SET month_index = 0;
+    SET month_start = DATE_FORMAT(CURDATE(), '%Y-%m-01');
+    WHILE month_index < months DO
+      SET shard_partition = CONCAT('p', DATE_FORMAT(month_start, '%Y%m'));
+      IF NOT EXISTS (SELECT 1 FROM information_schema.PARTITIONS
+                     WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = shard_table
+                       AND PARTITION_NAME = shard_partition) THEN
+        SET @split_sql = CONCAT('ALTER TABLE `', shard_table, '` REORGANIZE PARTITION p_max INTO (',
+          'PARTITION ', shard_partition,
+          ' VALUES LESS THAN (UNIX_TIMESTAMP(''', DATE_ADD(month_start, INTERVAL 1 MONTH), ''')), ',
+          'PARTITION p_max VALUES LESS THAN MAXVALUE)');
+        PREPARE stmt FROM @split_sql;
+        EXECUTE stmt;
+        DEALLOCATE PREPARE stmt;
+      END IF;
+      SET month_start = DATE_ADD(month_start, INTERVAL 1 MONTH);
+      SET month_index = month_index + 1;
+    END WHILE;
+    SET shard = shard + 1;
+  END WHILE;
+END$$
+
+DELIMITER ;
 
+-- 分表数需与构造MessageTable(common/mysql_operations.hpp)时传入的shard_count一致
+CALL create_message_shards(16, 12);
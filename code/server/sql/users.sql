@@ -23,3 +23,7 @@ CREATE UNIQUE INDEX `nickname_i`
 CREATE UNIQUE INDEX `phone_i`
   ON `users` (`phone`);
 
+
+-- 不另建(nickname, user_id, password)、(phone, user_id)等覆盖索引：按唯一索引等值查询为const访问，
+-- 只定位一行、回表一次，与覆盖索引相比差别可以忽略，而每次写入都要多维护一棵索引树；
+-- 组合列的唯一索引又不能保证昵称/手机号本身唯一。存在性检查查询常量(SELECT 1)，唯一索引即可覆盖
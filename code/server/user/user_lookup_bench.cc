@@ -0,0 +1,339 @@
+// 用户表查询的延迟基准：向本地Mysql中的独立库灌入大量用户，按各类查询分别统计延迟分位数
+// 修改users表结构或索引后运行：每类查询先以EXPLAIN检查使用的索引，再与--baseline中的结果比较，
+// 索引与预期或基线不一致、p99超出阈值时以非0状态退出
+#include <gflags/gflags.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include "../common/logger.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/mysql_operations.hpp"
+
+DEFINE_string(mysql_host, "127.0.0.1", "Mysql服务器访问地址");
+DEFINE_int32(mysql_port, 3306, "Mysql服务器访问端口");
+DEFINE_string(mysql_user, "root", "Mysql服务器访问用户名");
+DEFINE_string(mysql_pswd, "123456", "Mysql服务器访问密码");
+DEFINE_string(mysql_db, "chat_bench", "基准测试使用的库，需已存在，不要指向线上库");
+DEFINE_string(schema, "../sql/users.sql", "users表的建表脚本，灌数据前按该脚本重建表");
+DEFINE_int32(users, 2000000, "灌入的用户数");
+DEFINE_bool(reseed, false, "表中已有足够数据时是否仍然重建并重新灌入");
+DEFINE_int32(queries, 20000, "每类查询的执行次数");
+DEFINE_int32(threads, 8, "并发发起查询的线程数");
+DEFINE_int32(batch_size, 100, "批量查询每次查询的用户数");
+DEFINE_string(baseline, "", "基线结果文件，每行为\"查询名 索引 p99(us)\"，为空则只检查索引是否与预期一致");
+DEFINE_string(output, "", "本次结果按基线的格式写入该文件，可作为之后运行的基线");
+DEFINE_double(max_p99_regression, 0.2, "p99相对基线的最大增幅，超出视为退化");
+DEFINE_int32(p99_slack_us, 100, "判断p99退化时额外允许的绝对误差(us)，避免低延迟查询的抖动被误判为退化");
+
+namespace
+{
+    std::string userId(int64_t i) { return "bench-user-" + std::to_string(i); }
+    std::string nickname(int64_t i) { return "bench-nick-" + std::to_string(i); }
+    std::string phone(int64_t i)
+    {
+        std::string digits = std::to_string(i);
+        return "1" + std::string(10 - std::min<size_t>(10, digits.size()), '0') + digits;
+    }
+
+    // 执行建表脚本中的语句，跳过建库与切库语句，使表建在--mysql_db中
+    bool createSchema(chat_ns::MysqlConn &conn)
+    {
+        std::ifstream file(FLAGS_schema);
+        if (!file.is_open())
+        {
+            LOG_ERROR("打开建表脚本{}失败", FLAGS_schema);
+            return false;
+        }
+        std::stringstream content;
+        content << file.rdbuf();
+        std::stringstream statements(content.str());
+        std::string statement;
+        while (std::getline(statements, statement, ';'))
+        {
+            // 去掉注释行
+            std::stringstream lines(statement);
+            std::string line, sql;
+            while (std::getline(lines, line))
+            {
+                if (line.rfind("--", 0) == 0)
+                    continue;
+                sql.append(line).append("\n");
+            }
+            if (sql.find_first_not_of(" \n\r\t") == std::string::npos)
+                continue;
+            if (sql.find("CREATE DATABASE") != std::string::npos || sql.find("USE ") != std::string::npos)
+                continue;
+            if (!conn.query(sql))
+                return false;
+        }
+        return true;
+    }
+
+    int64_t countUsers(chat_ns::MysqlConn &conn)
+    {
+        if (!conn.query("SELECT COUNT(*) FROM users"))
+            return -1;
+        MYSQL_RES *res = mysql_store_result(conn.get());
+        if (res == nullptr)
+            return -1;
+        MYSQL_ROW row = mysql_fetch_row(res);
+        int64_t count = row && row[0] ? std::stoll(row[0]) : 0;
+        mysql_free_result(res);
+        return count;
+    }
+
+    // 每条INSERT写入1000行；description填充较长的文本，使回表的代价与线上接近
+    bool seed(const chat_ns::MysqlPool::ptr &pool)
+    {
+        auto conn = pool->acquire();
+        if (!conn)
+            return false;
+        if (FLAGS_reseed == false && countUsers(conn) >= FLAGS_users)
+        {
+            LOG_INFO("users表中已有不少于{}个用户，跳过灌数据", FLAGS_users);
+            return true;
+        }
+        if (!createSchema(conn))
+            return false;
+        const std::string description(200, 'd');
+        const int64_t kRowsPerInsert = 1000;
+        for (int64_t begin = 0; begin < FLAGS_users; begin += kRowsPerInsert)
+        {
+            std::string sql = "INSERT INTO users (user_id, nickname, description, password, phone, avatar_id) VALUES ";
+            int64_t end = std::min<int64_t>(begin + kRowsPerInsert, FLAGS_users);
+            for (int64_t i = begin; i < end; i++)
+            {
+                sql.append(i == begin ? "('" : ", ('").append(userId(i)).append("', '").append(nickname(i));
+                sql.append("', '").append(description).append("', 'password").append(std::to_string(i));
+                sql.append("', '").append(phone(i)).append("', 'avatar-").append(std::to_string(i)).append("')");
+            }
+            if (!conn.query(sql))
+                return false;
+            if ((end / kRowsPerInsert) % 100 == 0)
+                LOG_INFO("已灌入{}个用户", end);
+        }
+        return true;
+    }
+
+    int g_failures = 0;
+    void check(bool ok, const std::string &what)
+    {
+        if (ok == false)
+        {
+            printf("[FAIL] %s\n", what.c_str());
+            g_failures++;
+        }
+    }
+
+    // 取EXPLAIN结果第一行的key与Extra列
+    bool explain(chat_ns::MysqlConn &conn, const std::string &sql, std::string &key, std::string &extra)
+    {
+        if (!conn.query("EXPLAIN " + sql))
+            return false;
+        MYSQL_RES *res = mysql_store_result(conn.get());
+        if (res == nullptr)
+            return false;
+        unsigned int count = mysql_num_fields(res);
+        MYSQL_FIELD *fields = mysql_fetch_fields(res);
+        MYSQL_ROW row = mysql_fetch_row(res);
+        for (unsigned int i = 0; row && i < count; i++)
+        {
+            std::string name = fields[i].name;
+            if (name == "key")
+                key = row[i] ? row[i] : "NULL";
+            else if (name == "Extra")
+                extra = row[i] ? row[i] : "";
+        }
+        bool ok = row != nullptr;
+        mysql_free_result(res);
+        return ok;
+    }
+
+    // 一类查询：sql为以一个已灌入的用户展开的等价语句，用于EXPLAIN
+    struct Lookup
+    {
+        std::string name;
+        std::string sql;
+        std::string key;                   // 预期使用的索引
+        bool covering;                     // 是否应只读索引(Using index)
+        std::function<bool(int64_t)> run;
+    };
+    struct Baseline
+    {
+        std::string key;
+        int64_t p99 = 0;
+    };
+    std::map<std::string, Baseline> loadBaseline(const std::string &path)
+    {
+        std::map<std::string, Baseline> baseline;
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            LOG_ERROR("打开基线文件{}失败", path);
+            return baseline;
+        }
+        std::string name;
+        Baseline line;
+        while (file >> name >> line.key >> line.p99)
+        {
+            baseline[name] = line;
+        }
+        return baseline;
+    }
+
+    // 多个线程各执行一部分查询，汇总后输出延迟分位数(us)，返回p99，没有执行查询时返回-1
+    int64_t bench(const std::string &name, const std::function<bool(int64_t)> &lookup)
+    {
+        std::vector<std::vector<int64_t>> latencies(FLAGS_threads);
+        std::vector<std::thread> threads;
+        std::atomic<int64_t> failed(0);
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t t = 0; t < FLAGS_threads; t++)
+        {
+            threads.emplace_back([&, t]()
+                                 {
+                std::mt19937_64 rand(t);
+                std::uniform_int_distribution<int64_t> pick(0, FLAGS_users - 1);
+                for (int32_t i = t; i < FLAGS_queries; i += FLAGS_threads)
+                {
+                    auto begin = std::chrono::steady_clock::now();
+                    if (lookup(pick(rand)) == false)
+                        failed++;
+                    latencies[t].push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                               std::chrono::steady_clock::now() - begin)
+                                               .count());
+                } });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::vector<int64_t> all;
+        for (auto &latency : latencies)
+        {
+            all.insert(all.end(), latency.begin(), latency.end());
+        }
+        if (all.empty())
+            return -1;
+        std::sort(all.begin(), all.end());
+        auto percentile = [&all](double p)
+        {
+            return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+        };
+        printf("%-22s qps=%-8.0f p50=%-6ldus p90=%-6ldus p99=%-6ldus max=%-6ldus failed=%ld\n",
+               name.c_str(), all.size() / seconds, (long)percentile(0.5), (long)percentile(0.9),
+               (long)percentile(0.99), (long)all.back(), (long)failed.load());
+        check(failed.load() == 0, name + "有" + std::to_string(failed.load()) + "次查询失败");
+        return percentile(0.99);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    chat_ns::logger::initLogger(false, "", 0);
+
+    chat_ns::MysqlDataSourceOptions options;
+    options.primary.name = "bench";
+    options.primary.host = FLAGS_mysql_host;
+    options.primary.port = FLAGS_mysql_port;
+    options.primary.user = FLAGS_mysql_user;
+    options.primary.password = FLAGS_mysql_pswd;
+    options.primary.db = FLAGS_mysql_db;
+    options.primary.max_connections = FLAGS_threads * 2;
+    auto db_pool = std::make_shared<chat_ns::WorkerPool>("mysql", options.primary.max_connections);
+    auto source = chat_ns::MysqlDataSource::create(options, db_pool);
+    if (!source)
+        return -1;
+    chat_ns::MysqlPoolOptions seed_options = options.primary;
+    seed_options.name = "bench_seed";
+    seed_options.min_connections = 1;
+    auto pool = chat_ns::MysqlPool::create(seed_options);
+    if (!pool || !seed(pool))
+    {
+        LOG_ERROR("灌入基准数据失败");
+        return -1;
+    }
+    auto conn = pool->acquire();
+    if (!conn)
+        return -1;
+    auto literal = [&conn](const std::string &sql, const std::string &value)
+    {
+        std::string result = sql;
+        conn.appendQuoted(result, value);
+        return result;
+    };
+    std::string batch_ids;
+    for (int64_t i = 0; i < 3; i++)
+    {
+        batch_ids.append(i == 0 ? "" : ", ");
+        conn.appendQuoted(batch_ids, userId(i));
+    }
+
+    chat_ns::UserTable users(source);
+    const std::string columns = "SELECT id, user_id, nickname, description, password, phone, avatar_id FROM users WHERE ";
+    std::vector<Lookup> lookups = {
+        {"getUserById", literal(columns + "user_id = ", userId(0)), "user_id_i", false, [&](int64_t i)
+         { chat_ns::User user; return users.getUserById(userId(i), user); }},
+        {"getUserByNickname", literal(columns + "nickname = ", nickname(0)), "nickname_i", false, [&](int64_t i)
+         { chat_ns::User user; return users.getUserByNickname(nickname(i), user); }},
+        {"getUserByPhone", literal(columns + "phone = ", phone(0)), "phone_i", false, [&](int64_t i)
+         { chat_ns::User user; return users.getUserByPhone(phone(i), user); }},
+        {"getLoginByNickname", literal("SELECT user_id, password FROM users WHERE nickname = ", nickname(0)), "nickname_i", false, [&](int64_t i)
+         { std::string user_id, password; return users.getLoginByNickname(nickname(i), user_id, password); }},
+        {"getUserIdByPhone", literal("SELECT user_id FROM users WHERE phone = ", phone(0)), "phone_i", false, [&](int64_t i)
+         { std::string user_id; return users.getUserIdByPhone(phone(i), user_id); }},
+        {"existsNickname", literal("SELECT 1 FROM users WHERE nickname = ", nickname(0)), "nickname_i", true, [&](int64_t i)
+         { return users.existsNickname(nickname(i)); }},
+        {"existsPhone", literal("SELECT 1 FROM users WHERE phone = ", phone(0)), "phone_i", true, [&](int64_t i)
+         { return users.existsPhone(phone(i)); }},
+        {"getUsersById(batch)", columns + "user_id IN (" + batch_ids + ")", "user_id_i", false, [&](int64_t i)
+         {
+             std::vector<std::string> ids;
+             for (int32_t k = 0; k < FLAGS_batch_size; k++)
+                 ids.push_back(userId((i + k * 7919) % FLAGS_users));
+             size_t rows = 0;
+             return users.getUsersById(ids, [&rows](const chat_ns::UserRow &) { rows++; }) && rows > 0; }},
+    };
+
+    std::map<std::string, Baseline> baseline;
+    if (!FLAGS_baseline.empty())
+    {
+        baseline = loadBaseline(FLAGS_baseline);
+        check(!baseline.empty(), "基线文件" + FLAGS_baseline + "为空或无法读取");
+    }
+    std::ofstream output;
+    if (!FLAGS_output.empty())
+        output.open(FLAGS_output);
+    for (auto &lookup : lookups)
+    {
+        std::string key, extra;
+        if (!explain(conn, lookup.sql, key, extra))
+        {
+            check(false, lookup.name + "的EXPLAIN执行失败");
+            continue;
+        }
+        printf("%-22s key=%s extra=%s\n", lookup.name.c_str(), key.c_str(), extra.c_str());
+        check(key == lookup.key, lookup.name + "使用的索引为" + key + "，预期为" + lookup.key);
+        if (lookup.covering)
+            check(extra.find("Using index") != std::string::npos, lookup.name + "需要回表(" + extra + ")，预期只读索引");
+        int64_t p99 = bench(lookup.name, lookup.run);
+        if (output.is_open())
+            output << lookup.name << " " << key << " " << p99 << "\n";
+        auto it = baseline.find(lookup.name);
+        if (it == baseline.end())
+            continue;
+        check(key == it->second.key, lookup.name + "使用的索引由" + it->second.key + "变为" + key);
+        int64_t limit = static_cast<int64_t>(it->second.p99 * (1 + FLAGS_max_p99_regression)) + FLAGS_p99_slack_us;
+        check(p99 <= limit, lookup.name + "的p99由" + std::to_string(it->second.p99) + "us升至" +
+                                std::to_string(p99) + "us，超出上限" + std::to_string(limit) + "us");
+    }
+    printf("%d项检查失败\n", g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
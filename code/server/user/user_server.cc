@@ -1,24 +1,43 @@
 // 主要实现语音识别子服务的服务器的搭建
 #include "user_server.hpp"
 
-DEFINE_bool(run_mode, false, "程序的运行模式，false-调试； true-发布；");
-DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
-DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+CHAT_DEFINE_SERVER_FLAGS("/user_service/instance", "127.0.0.1:10003", 10003);
 
-DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
-DEFINE_string(instance_name, "/user_service/instance", "当前实例名称");
-DEFINE_string(access_host, "127.0.0.1:10003", "当前实例的外部访问地址");
-
-DEFINE_int32(listen_port, 10003, "Rpc服务器监听端口");
-DEFINE_int32(rpc_timeout, -1, "Rpc调用超时时间");
-DEFINE_int32(rpc_threads, 1, "Rpc的IO线程数量");
-
-DEFINE_string(base_service, "/service", "服务监控根目录");
 DEFINE_string(file_service, "/service/file_service", "文件管理子服务名称");
+DEFINE_int32(discovery_debounce_ms, 100, "服务发现事件合并窗口(ms)");
+DEFINE_string(discovery_snapshot, "./discovery_snapshot.json", "服务发现本地快照文件，为空则不使用快照");
+DEFINE_double(file_breaker_error_ratio, 0.5, "文件子服务熔断的错误率阈值");
+DEFINE_int32(file_breaker_open_ms, 5000, "文件子服务熔断持续时间(ms)");
+DEFINE_double(file_retry_budget_ratio, 0.1, "文件子服务重试量占总请求量的比例上限");
+DEFINE_string(file_connection_type, "single", "文件子服务小请求的连接方式(single/pooled/short)");
+DEFINE_int32(file_connections_per_host, 1, "文件子服务每个节点的小请求连接数");
+DEFINE_string(file_bulk_connection_type, "pooled", "文件子服务文件传输请求的连接方式(single/pooled/short)");
+DEFINE_int32(file_bulk_timeout, -1, "文件子服务文件传输请求的超时时间(ms)");
+DEFINE_bool(file_prefer_unix_socket, true, "同机的文件子服务节点提供unix域套接字时，经由该套接字访问");
 
 DEFINE_string(es_host, "http://127.0.0.1:9200/", "ES搜索引擎服务器URL");
 
 
+DEFINE_string(mysql_host, "127.0.0.1", "Mysql服务器访问地址");
+DEFINE_int32(mysql_port, 3306, "Mysql服务器访问端口");
+DEFINE_string(mysql_user, "root", "Mysql服务器访问用户名");
+DEFINE_string(mysql_pswd, "123456", "Mysql服务器访问密码");
+DEFINE_string(mysql_db, "chat", "Mysql默认库名称");
+DEFINE_string(mysql_cset, "utf8", "Mysql客户端字符集");
+DEFINE_int32(mysql_pool_min, 2, "Mysql连接池启动时建立的连接数");
+DEFINE_int32(mysql_pool_max, 16, "Mysql连接池的连接数上限");
+DEFINE_int32(mysql_acquire_timeout, 1000, "获取Mysql连接的最长等待时间(ms)");
+DEFINE_int32(mysql_idle_check, 30000, "Mysql连接空闲超过该时间后，借出前先检查连接是否有效(ms)");
+DEFINE_int32(mysql_max_statements, 64, "每个Mysql连接缓存的预处理语句数上限，超出时关闭最久未使用的语句");
+DEFINE_int32(mysql_queue_max, 1024, "等待执行的数据库操作数上限，超出时快速失败，0表示不限制");
+DEFINE_string(mysql_replicas, "", "Mysql从库地址列表，如\"10.0.0.2:3306,10.0.0.3:3306\"，与主库使用相同的账号与库名，为空则读写都走主库");
+DEFINE_int32(mysql_read_your_writes, 2000, "写入后该时间内，读取同一用户的请求走主库(ms)");
+DEFINE_bool(mysql_shared_read_your_writes, true, "最近写入的用户记录在Redis中，所有实例共享；为false时只在写入的实例内读主库");
+DEFINE_int32(mysql_max_replica_lag, 5, "从库复制延迟超过该值时不再承担读请求(s)");
+DEFINE_int32(mysql_lag_check, 1000, "从库复制延迟的检查间隔(ms)");
+DEFINE_int32(mysql_batch_rows, 32, "合并为一条INSERT的最大行数，0表示逐条写入");
+DEFINE_int32(mysql_batch_delay, 2, "合并写入时，第一行最多等待该时间凑批(ms)");
+
 DEFINE_string(redis_host, "127.0.0.1", "Redis服务器访问地址");
 DEFINE_int32(redis_port, 6379, "Redis服务器访问端口");
 DEFINE_int32(redis_db, 0, "Redis默认库号");
@@ -27,17 +46,64 @@ DEFINE_bool(redis_keep_alive, true, "Redis长连接保活选项");
 
 int main(int argc, char *argv[])
 {
-    google::ParseCommandLineFlags(&argc, &argv, true);
-    chat_ns::logger::initLogger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    chat_ns::BootstrapOptions options = chat_ns::bootstrap(argc, argv);
 
     chat_ns::UserServerBuilder usb;
 
-    usb.make_es_object({FLAGS_es_host});
+    auto es_pool = std::make_shared<chat_ns::WorkerPool>("es", options.threads.blocking_threads, options.threads.cpus);
+    usb.make_es_object({FLAGS_es_host}, es_pool);
+    chat_ns::MysqlDataSourceOptions mysql_options;
+    mysql_options.primary.host = FLAGS_mysql_host;
+    mysql_options.primary.port = FLAGS_mysql_port;
+    mysql_options.primary.user = FLAGS_mysql_user;
+    mysql_options.primary.password = FLAGS_mysql_pswd;
+    mysql_options.primary.db = FLAGS_mysql_db;
+    mysql_options.primary.charset = FLAGS_mysql_cset;
+    mysql_options.primary.min_connections = FLAGS_mysql_pool_min;
+    mysql_options.primary.max_connections = FLAGS_mysql_pool_max;
+    mysql_options.primary.acquire_timeout_ms = FLAGS_mysql_acquire_timeout;
+    mysql_options.primary.idle_check_ms = FLAGS_mysql_idle_check;
+    mysql_options.primary.max_statements = FLAGS_mysql_max_statements;
+    std::stringstream replicas(FLAGS_mysql_replicas);
+    std::string replica;
+    while (std::getline(replicas, replica, ','))
+    {
+        if (replica.empty())
+            continue;
+        chat_ns::MysqlPoolOptions replica_options = mysql_options.primary;
+        replica_options.name = "replica" + std::to_string(mysql_options.replicas.size());
+        auto pos = replica.find(':');
+        replica_options.host = replica.substr(0, pos);
+        if (pos != std::string::npos)
+            replica_options.port = std::stoi(replica.substr(pos + 1));
+        mysql_options.replicas.push_back(replica_options);
+    }
+    mysql_options.read_your_writes_ms = FLAGS_mysql_read_your_writes;
+    mysql_options.max_replica_lag_s = FLAGS_mysql_max_replica_lag;
+    mysql_options.lag_check_ms = FLAGS_mysql_lag_check;
+    // 每个数据库线程同时只占用一个连接，线程数与各库连接数上限之和一致
+    int32_t db_threads = FLAGS_mysql_pool_max * (1 + mysql_options.replicas.size());
+    auto db_pool = std::make_shared<chat_ns::WorkerPool>("mysql", db_threads, options.threads.cpus, FLAGS_mysql_queue_max);
+    chat_ns::InsertBatcherOptions user_batch;
+    user_batch.max_rows = std::max(0, FLAGS_mysql_batch_rows);
+    user_batch.max_delay_ms = FLAGS_mysql_batch_delay;
     usb.make_redis_object(FLAGS_redis_host, FLAGS_redis_port, FLAGS_redis_db, FLAGS_redis_keep_alive);
-    usb.make_discovery_object(FLAGS_registry_host, FLAGS_base_service, FLAGS_file_service);
-    usb.make_rpc_server(FLAGS_listen_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
-    usb.make_registry_object(FLAGS_registry_host, FLAGS_base_service + FLAGS_instance_name, FLAGS_access_host);
+    usb.make_mysql_object(mysql_options, db_pool, user_batch, FLAGS_mysql_shared_read_your_writes);
+    chat_ns::ServiceChannelOptions file_channel_options;
+    file_channel_options.breaker_error_ratio = FLAGS_file_breaker_error_ratio;
+    file_channel_options.breaker_open_ms = FLAGS_file_breaker_open_ms;
+    file_channel_options.retry_budget_ratio = FLAGS_file_retry_budget_ratio;
+    file_channel_options.connection_type = FLAGS_file_connection_type;
+    file_channel_options.connections_per_host = FLAGS_file_connections_per_host;
+    file_channel_options.bulk_connection_type = FLAGS_file_bulk_connection_type;
+    file_channel_options.bulk_timeout_ms = FLAGS_file_bulk_timeout;
+    file_channel_options.prefer_unix_socket = FLAGS_file_prefer_unix_socket;
+    chat_ns::Locality locality;
+    locality.zone = FLAGS_zone;
+    usb.make_discovery_object(options.registry_host, options.base_service, FLAGS_file_service, file_channel_options, locality, FLAGS_discovery_snapshot, FLAGS_discovery_debounce_ms);
+    usb.make_rpc_server(options.rpc);
+    usb.make_registry_object(options.registry_host, options.instance_key, options.meta, options.registry_ttl, options.load_report);
     auto server = usb.build();
-    server->start();
+    server->start(options.drain);
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include <brpc/server.h>
 #include <butil/logging.h>
 #include "../common/etcd.hpp"
+#include "../common/load.hpp"
+#include "../common/drain.hpp"
+#include "../common/concurrency.hpp"
+#include "../common/bootstrap.hpp"
 #include "../common/logger.hpp"
+#include "../common/trace.hpp"
 #include "../common/sms.hpp"
 #include "../common/es_operations.hpp"
 #include "../common/mysql_operations.hpp"
@@ -19,11 +24,15 @@ namespace chat_ns
     {
     public:
         UserServiceImpl(const std::shared_ptr<elasticlient::Client> &es_client,
+                        const MysqlDataSource::ptr &mysql_source,
+                        const InsertBatcherOptions &user_batch,
                         const std::shared_ptr<sw::redis::Redis> &redis_client,
                         const ServiceManager::ptr &channel_manager,
-                        const std::string &file_service_name)
+                        const std::string &file_service_name,
+                        const WorkerPool::ptr &es_pool = nullptr)
             : _es_user(std::make_shared<ESUser>(es_client)),
-              _mysql_user(std::make_shared<UserTable>()),
+              _es_pool(es_pool),
+              _mysql_user(std::make_shared<UserTable>(mysql_source, user_batch)),
               _redis_session(std::make_shared<Session>(redis_client)),
               _redis_status(std::make_shared<Status>(redis_client)),
               _redis_codes(std::make_shared<Codes>(redis_client)),
@@ -45,6 +54,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户昵称注册请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.UserRegister");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -66,7 +76,7 @@ namespace chat_ns
                 return err_response(request->request_id(), "密码格式不合法！");
             }
             User user = {0};
-            if (_mysql_user->getUserByNickname(nickname, user) == true)
+            if (_mysql_user->existsNickname(nickname) == true)
             {
                 LOG_ERROR("{} - 用户名被占用- {}！", request->request_id(), nickname);
                 return err_response(request->request_id(), "用户名被占用!");
@@ -79,7 +89,7 @@ namespace chat_ns
                 LOG_ERROR("{} - Mysql数据库新增数据失败！", request->request_id());
                 return err_response(request->request_id(), "Mysql数据库新增数据失败!");
             }
-            if (_es_user->appendData(user.user_id, "", user.nickname, "", "") == false)
+            if (appendUser(user.user_id, "", user.nickname, "", "") == false)
             {
                 LOG_ERROR("{} - ES搜索引擎新增数据失败！", request->request_id());
                 return err_response(request->request_id(), "ES搜索引擎新增数据失败！");
@@ -94,6 +104,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户昵称登录请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.UserLogin");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -104,20 +115,20 @@ namespace chat_ns
             };
             std::string nickname = request->nickname();
             std::string password = request->password();
-            User user = {0};
-            if (_mysql_user->getUserByNickname(nickname, user) || user.password != password)
+            std::string user_id, user_password;
+            if (_mysql_user->getLoginByNickname(nickname, user_id, user_password) == false || user_password != password)
             {
                 LOG_ERROR("{} - 用户名或密码错误 - {}-{}！", request->request_id(), nickname, password);
                 return err_response(request->request_id(), "用户名或密码错误!");
             }
-            if (_redis_status->exists(user.user_id) == true)
+            if (_redis_status->exists(user_id) == true)
             {
                 LOG_ERROR("{} - 用户已在其他地方登录 - {}！", request->request_id(), nickname);
                 return err_response(request->request_id(), "用户已在其他地方登录!");
             }
             std::string ssid = Utils::uuid();
-            _redis_session->append(ssid, user.user_id);
-            _redis_status->append(user.user_id);
+            _redis_session->append(ssid, user_id);
+            _redis_status->append(user_id);
             response->set_request_id(request->request_id());
             response->set_login_session_id(ssid);
             response->set_success(true);
@@ -129,6 +140,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到短信验证码获取请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.GetPhoneVerifyCode");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -159,6 +171,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到手机号注册请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.PhoneRegister");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -175,13 +188,20 @@ namespace chat_ns
                 LOG_ERROR("{} - 手机号码格式错误 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "手机号码格式错误!");
             }
-            if (_redis_codes->code(code_id) != code)
+            // 校验验证码与查询手机号是否已注册互不依赖，两者并发执行
+            bool code_ok = false;
+            auto calls = std::make_shared<CallGroup>();
+            calls->spawn([&]()
+                         { code_ok = checkCode(request->request_id(), code_id, code); });
+            bool registered = _mysql_user->existsPhone(phone);
+            calls->wait();
+            if (code_ok == false)
             {
                 LOG_ERROR("{} - 验证码错误 - {}-{}！", request->request_id(), code_id, code);
                 return err_response(request->request_id(), "验证码错误!");
             }
             User user = {0};
-            if (_mysql_user->getUserByPhone(phone, user) == true)
+            if (registered == true)
             {
                 LOG_ERROR("{} - 该手机号已注册过用户 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "该手机号已注册过用户!");
@@ -196,7 +216,7 @@ namespace chat_ns
                 LOG_ERROR("{} - 向数据库添加用户信息失败 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "向数据库添加用户信息失败!");
             }
-            if (_es_user->appendData(uid, phone, uid, "", "") == false)
+            if (appendUser(uid, phone, uid, "", "") == false)
             {
                 LOG_ERROR("{} - ES搜索引擎新增数据失败！", request->request_id());
                 return err_response(request->request_id(), "ES搜索引擎新增数据失败！");
@@ -211,6 +231,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到手机号登录请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.PhoneLogin");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -227,26 +248,33 @@ namespace chat_ns
                 LOG_ERROR("{} - 手机号码格式错误 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "手机号码格式错误!");
             }
-            User user = {0};
-            if (_mysql_user->getUserByPhone(phone, user) == false)
+            // 查询手机号对应的用户与校验验证码互不依赖，两者并发执行
+            bool code_ok = false;
+            auto calls = std::make_shared<CallGroup>();
+            calls->spawn([&]()
+                         { code_ok = checkCode(request->request_id(), code_id, code); });
+            std::string user_id;
+            bool registered = _mysql_user->getUserIdByPhone(phone, user_id);
+            calls->wait();
+            if (registered == false)
             {
                 LOG_ERROR("{} - 该手机号未注册用户 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "该手机号未注册用户!");
             }
-            if (_redis_codes->code(code_id) != code)
+            if (code_ok == false)
             {
                 LOG_ERROR("{} - 验证码错误 - {}-{}！", request->request_id(), code_id, code);
                 return err_response(request->request_id(), "验证码错误!");
             }
             _redis_codes->remove(code_id);
-            if (_redis_status->exists(user.user_id) == true)
+            if (_redis_status->exists(user_id) == true)
             {
                 LOG_ERROR("{} - 用户已在其他地方登录 - {}！", request->request_id(), phone);
                 return err_response(request->request_id(), "用户已在其他地方登录!");
             }
             std::string ssid = Utils::uuid();
-            _redis_session->append(ssid, user.user_id);
-            _redis_status->append(user.user_id);
+            _redis_session->append(ssid, user_id);
+            _redis_status->append(user_id);
             response->set_request_id(request->request_id());
             response->set_login_session_id(ssid);
             response->set_success(true);
@@ -258,6 +286,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到获取单个用户信息请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.GetUserInfo");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -318,6 +347,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到批量用户信息获取请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.GetMultiUserInfo");
             // 1. 定义错误回调
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
@@ -333,46 +363,65 @@ namespace chat_ns
             {
                 uid_lists.push_back(request->users_id(i));
             }
-            // 3. 从数据库进行批量用户信息查询
-            std::unordered_map<std::string, User> users;
-            _mysql_user->getUsersById(uid_lists, users);
-            // 4. 批量从文件管理子服务进行文件下载
-            auto channel = _mm_channels->choose(_file_service_name);
-            if (!channel)
-            {
-                LOG_ERROR("{} - 未找到文件管理子服务节点 - {}！", request->request_id(), _file_service_name);
-                return err_response(request->request_id(), "未找到文件管理子服务节点!");
-            }
-            chat_ns::FileService_Stub stub(channel.get());
+            // 3. 从数据库进行批量用户信息查询，逐行直接解码到响应中
             chat_ns::GetMultiFileReq req;
             chat_ns::GetMultiFileRsp rsp;
             req.set_request_id(request->request_id());
-            for (auto &[id, user] : users)
+            auto user_map = response->mutable_users_info(); // 本次请求要响应的用户信息map
+            std::vector<UserInfo *> avatar_users;            // 与req中的头像文件ID一一对应
+            bool ret = _mysql_user->getUsersById(uid_lists, [&](const UserRow &user)
+                                                 {
+                UserInfo &user_info = (*user_map)[std::string(user.user_id)];
+                user_info.set_user_id(user.user_id.data(), user.user_id.size());
+                user_info.set_nickname(user.nickname.data(), user.nickname.size());
+                user_info.set_description(user.description.data(), user.description.size());
+                user_info.set_phone(user.phone.data(), user.phone.size());
+                if (user.avatar_id.empty())
+                    return;
+                req.add_file_id_list(user.avatar_id.data(), user.avatar_id.size());
+                avatar_users.push_back(&user_info); });
+            // 分块查询中任一块失败时结果不完整，不能当作部分用户不存在返回
+            if (ret == false)
             {
-                if (user.avatar_id == "")
-                    continue;
-                req.add_file_id_list(user.avatar_id);
+                LOG_ERROR("{} - 从数据库批量获取用户信息失败！", request->request_id());
+                return err_response(request->request_id(), "从数据库批量获取用户信息失败!");
             }
-            brpc::Controller cntl;
-            stub.GetMultiFile(&cntl, &req, &rsp, nullptr);
-            if (cntl.Failed() == true || rsp.success() == false)
+            // 4. 批量从文件管理子服务进行文件下载；没有用户设置头像时不调用，也不占用熔断器的探测名额
+            if (req.file_id_list_size() > 0)
             {
-                LOG_ERROR("{} - 文件子服务调用失败：{} - {}！", request->request_id(),
-                          _file_service_name, cntl.ErrorText());
-                return err_response(request->request_id(), "文件子服务调用失败!");
+                auto channel = _mm_channels->choose(_file_service_name, TrafficClass::BULK);
+                if (!channel)
+                {
+                    LOG_ERROR("{} - 未找到文件管理子服务节点 - {}！", request->request_id(), _file_service_name);
+                    return err_response(request->request_id(), "未找到文件管理子服务节点!");
+                }
+                chat_ns::FileService_Stub stub(channel.get());
+                brpc::Controller cntl;
+                stub.GetMultiFile(&cntl, &req, &rsp, nullptr);
+                if (cntl.Failed() == true || rsp.success() == false)
+                {
+                    LOG_ERROR("{} - 文件子服务调用失败：{} - {}！", request->request_id(),
+                              _file_service_name, cntl.ErrorText());
+                    return err_response(request->request_id(), "文件子服务调用失败!");
+                }
             }
-            // 5. 组织响应（）
-            for (auto &[id, user] : users)
+            // 5. 组织响应，头像内容从文件响应中移入；同一头像被多个用户使用时，只在最后一次使用时移出
+            auto file_map = rsp.mutable_file_data(); // 这是批量文件请求响应中的map
+            std::vector<bool> last_use(req.file_id_list_size());
+            std::unordered_set<std::string_view> seen;
+            for (int i = req.file_id_list_size() - 1; i >= 0; i--)
             {
-                auto user_map = response->mutable_users_info(); // 本次请求要响应的用户信息map
-                auto file_map = rsp.mutable_file_data();        // 这是批量文件请求响应中的map
-                UserInfo user_info;
-                user_info.set_user_id(user.user_id);
-                user_info.set_nickname(user.nickname);
-                user_info.set_description(user.description);
-                user_info.set_phone(user.phone);
-                user_info.set_avatar((*file_map)[user.avatar_id].file_content());
-                (*user_map)[user_info.user_id()] = user_info;
+                last_use[i] = seen.insert(req.file_id_list(i)).second;
+            }
+            for (int i = 0; i < req.file_id_list_size(); i++)
+            {
+                auto it = file_map->find(req.file_id_list(i));
+                if (it == file_map->end())
+                    continue;
+                if (last_use[i])
+                    avatar_users[i]->set_avatar(std::move(*it->second.mutable_file_content()));
+                else
+                    avatar_users[i]->set_avatar(it->second.file_content());
             }
             response->set_request_id(request->request_id());
             response->set_success(true);
@@ -384,6 +433,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户头像设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.SetUserAvatar");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -395,14 +445,15 @@ namespace chat_ns
             // 1. 从请求中取出用户 ID 与头像数据
             std::string uid = request->user_id();
             // 2. 从数据库通过用户 ID 进行用户信息查询，判断用户是否存在
+            // 上传头像会在文件子服务中留下文件，必须在确认用户存在之后再上传，不能与查询并发
             User user = {0};
             if (_mysql_user->getUserById(uid, user) == false)
             {
                 LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
                 return err_response(request->request_id(), "未找到用户信息!");
             }
-            // 3. 上传头像文件到文件子服务，
-            auto channel = _mm_channels->choose(_file_service_name);
+            // 3. 上传头像文件到文件子服务
+            auto channel = _mm_channels->choose(_file_service_name, TrafficClass::BULK);
             if (!channel)
             {
                 LOG_ERROR("{} - 未找到文件管理子服务节点 - {}！", request->request_id(), _file_service_name);
@@ -432,8 +483,8 @@ namespace chat_ns
                 return err_response(request->request_id(), "更新数据库用户头像ID失败!");
             }
             // 5. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user.user_id, user.phone,
-                                       user.nickname, user.description, user.avatar_id);
+            ret = appendUser(user.user_id, user.phone,
+                             user.nickname, user.description, user.avatar_id);
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户头像ID失败 ：{}！", request->request_id(), avatar_id);
@@ -450,6 +501,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户昵称设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.SetUserNickname");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -484,8 +536,8 @@ namespace chat_ns
                 return err_response(request->request_id(), "更新数据库用户昵称失败!");
             }
             // 5. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user.user_id, user.phone,
-                                       user.nickname, user.description, user.avatar_id);
+            ret = appendUser(user.user_id, user.phone,
+                             user.nickname, user.description, user.avatar_id);
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户昵称失败 ：{}！", request->request_id(), new_nickname);
@@ -502,6 +554,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户签名设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.SetUserDescription");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -530,8 +583,8 @@ namespace chat_ns
                 return err_response(request->request_id(), "更新数据库用户签名失败!");
             }
             // 4. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user.user_id, user.phone,
-                                       user.nickname, user.description, user.avatar_id);
+            ret = appendUser(user.user_id, user.phone,
+                             user.nickname, user.description, user.avatar_id);
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户签名失败 ：{}！", request->request_id(), new_description);
@@ -548,6 +601,7 @@ namespace chat_ns
         {
             LOG_DEBUG("收到用户手机号设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            TraceScope trace(request->request_id(), "UserService.SetUserPhoneNumber");
             auto err_response = [this, response](const std::string &rid,
                                                  const std::string &errmsg) -> void
             {
@@ -584,8 +638,8 @@ namespace chat_ns
                 return err_response(request->request_id(), "更新数据库用户手机号失败!");
             }
             // 5. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user.user_id, user.phone,
-                                       user.nickname, user.description, user.avatar_id);
+            ret = appendUser(user.user_id, user.phone,
+                             user.nickname, user.description, user.avatar_id);
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户手机号失败 ：{}！", request->request_id(), new_phone);
@@ -636,9 +690,38 @@ namespace chat_ns
             }
             return true;
         }
+        // es客户端是同步http调用，在阻塞任务线程池中执行，不占用bthread工作线程
+        bool appendUser(const std::string &uid,
+                        const std::string &phone,
+                        const std::string &nickname,
+                        const std::string &description,
+                        const std::string &avatar_id)
+        {
+            bool ret = false;
+            if (!_es_pool)
+                return _es_user->appendData(uid, phone, nickname, description, avatar_id);
+            if (_es_pool->run([&]()
+                              { ret = _es_user->appendData(uid, phone, nickname, description, avatar_id); }) == false)
+                return false;
+            return ret;
+        }
+        // 在CallGroup的任务中执行：异常不能越过bthread入口，redis出错时按校验失败处理
+        bool checkCode(const std::string &rid, const std::string &code_id, const std::string &code)
+        {
+            try
+            {
+                return _redis_codes->code(code_id) == code;
+            }
+            catch (const sw::redis::Error &e)
+            {
+                LOG_ERROR("{} - 查询验证码失败 - {}: {}", rid, code_id, e.what());
+                return false;
+            }
+        }
 
     private:
         ESUser::ptr _es_user;
+        WorkerPool::ptr _es_pool;
         UserTable::ptr _mysql_user;
         Session::ptr _redis_session;
         Status::ptr _redis_status;
@@ -663,10 +746,10 @@ namespace chat_ns
                                                                   _redis_client(redis_client),
                                                                   _rpc_server(server) {}
         ~UserServer() {}
-        // 搭建RPC服务器，并启动服务器
-        void start()
+        // 搭建RPC服务器，并启动服务器；收到退出信号后优雅下线
+        void start(const DrainOptions &drain_options = DrainOptions())
         {
-            _rpc_server->RunUntilAskedToQuit();
+            runUntilDrained(_rpc_server, _registry_client, drain_options);
         }
 
     private:
@@ -680,10 +763,11 @@ namespace chat_ns
     class UserServerBuilder
     {
     public:
-        // 构造es客户端对象
-        void make_es_object(const std::vector<std::string> host_list)
+        // 构造es客户端对象；es_pool非空时es调用在其中执行
+        void make_es_object(const std::vector<std::string> host_list, const WorkerPool::ptr &es_pool = nullptr)
         {
             _es_client = ESClientFactory::create(host_list);
+            _es_pool = es_pool;
         }
         // 构造redis客户端对象
         void make_redis_object(const std::string &host,
@@ -693,34 +777,71 @@ namespace chat_ns
         {
             _redis_client = RedisClientFactory::create(host, port, db, keep_alive);
         }
+        // 构造mysql主从数据源，所有表操作共用；db_pool非空时数据库操作在其中执行，不占用rpc工作线程
+        // user_batch：用户注册写入的合并配置，max_rows为0时逐条写入
+        // shared_recent_writes：最近写入的key记录在Redis中，多个实例间保证读到自己的写入，需先构造redis客户端
+        void make_mysql_object(const MysqlDataSourceOptions &options, const WorkerPool::ptr &db_pool = nullptr,
+                               const InsertBatcherOptions &user_batch = InsertBatcherOptions(),
+                               bool shared_recent_writes = false)
+        {
+            _user_batch_options = user_batch;
+            RecentWrites::ptr recent_writes;
+            if (shared_recent_writes)
+            {
+                if (!_redis_client)
+                {
+                    LOG_ERROR("还未初始化Redis数据库模块，无法共享最近写入记录！");
+                    abort();
+                }
+                recent_writes = std::make_shared<RedisRecentWrites>(_redis_client);
+            }
+            _mysql_source = MysqlDataSource::create(options, db_pool, recent_writes);
+            if (!_mysql_source)
+            {
+                LOG_ERROR("Mysql连接池初始化失败！");
+                abort();
+            }
+        }
         // 用于构造服务发现客户端&信道管理对象
         void make_discovery_object(const std::string &reg_host,
                                    const std::string &base_service_name,
-                                   const std::string &file_service_name)
+                                   const std::string &file_service_name,
+                                   const ServiceChannelOptions &file_channel_options = ServiceChannelOptions(),
+                                   const Locality &locality = Locality(),
+                                   const std::string &snapshot_file = "",
+                                   int32_t debounce_ms = 100)
         {
             _file_service_name = file_service_name;
             _mm_channels = std::make_shared<ServiceManager>();
-            _mm_channels->declared(file_service_name);
+            _mm_channels->setLocality(locality);
+            _mm_channels->declared(file_service_name, file_channel_options);
             LOG_DEBUG("设置文件子服务为需添加管理的子服务：{}", file_service_name);
-            auto put_cb = std::bind(&ServiceManager::onServiceOnline, _mm_channels.get(), std::placeholders::_1, std::placeholders::_2);
-            auto del_cb = std::bind(&ServiceManager::onServiceOffline, _mm_channels.get(), std::placeholders::_1, std::placeholders::_2);
-            _service_discoverer = std::make_shared<Discovery>(reg_host, base_service_name, put_cb, del_cb);
+            auto batch_cb = std::bind(&ServiceManager::onServiceBatch, _mm_channels.get(), std::placeholders::_1);
+            _service_discoverer = std::make_shared<Discovery>(reg_host, base_service_name, Discovery::BatchCallback(batch_cb), snapshot_file, debounce_ms);
         }
         // 用于构造服务注册客户端对象
         void make_registry_object(const std::string &reg_host,
                                   const std::string &service_name,
-                                  const std::string &access_host)
+                                  const InstanceMeta &meta,
+                                  int ttl = 3,
+                                  const LoadReportOptions &load_options = LoadReportOptions())
         {
-            _registry_client = std::make_shared<Registry>(reg_host);
-            _registry_client->registry(service_name, access_host);
+            _registry_client = std::make_shared<Registry>(reg_host, ttl);
+            _load_report_options = load_options;
+            _registry_client->registry(service_name, meta);
         }
-        void make_rpc_server(uint16_t port, int32_t timeout, uint8_t num_threads)
+        void make_rpc_server(const RpcServerOptions &rpc_options)
         {
             if (!_es_client)
             {
                 LOG_ERROR("还未初始化ES搜索引擎模块！");
                 abort();
             }
+            if (!_mysql_source)
+            {
+                LOG_ERROR("还未初始化Mysql数据库模块！");
+                abort();
+            }
             if (!_redis_client)
             {
                 LOG_ERROR("还未初始化Redis数据库模块！");
@@ -734,7 +855,7 @@ namespace chat_ns
 
             _rpc_server = std::make_shared<brpc::Server>();
 
-            UserServiceImpl *user_service = new UserServiceImpl(_es_client, _redis_client, _mm_channels, _file_service_name);
+            UserServiceImpl *user_service = new UserServiceImpl(_es_client, _mysql_source, _user_batch_options, _redis_client, _mm_channels, _file_service_name, _es_pool);
             int ret = _rpc_server->AddService(user_service,
                                               brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
@@ -742,10 +863,10 @@ namespace chat_ns
                 LOG_ERROR("添加Rpc服务失败！");
                 abort();
             }
-            brpc::ServerOptions options;
-            options.idle_timeout_sec = timeout;
-            options.num_threads = num_threads;
-            ret = _rpc_server->Start(port, &options);
+            if (applyMethodConcurrency(*_rpc_server, user_service, rpc_options.concurrency) == false)
+                abort();
+            brpc::ServerOptions options = rpc_options.toServerOptions();
+            ret = _rpc_server->Start(rpc_options.port, &options);
             if (ret == -1)
             {
                 LOG_ERROR("服务启动失败！");
@@ -770,6 +891,8 @@ namespace chat_ns
                 LOG_ERROR("还未初始化RPC服务器模块！");
                 abort();
             }
+            // 定期上报本实例负载，供调用方按剩余容量分配流量
+            _registry_client->startLoadReport(ServerLoadSampler(_rpc_server->listen_address().port), _load_report_options);
             UserServer::ptr server = std::make_shared<UserServer>(
                 _service_discoverer, _registry_client,
                 _es_client, _redis_client, _rpc_server);
@@ -778,8 +901,12 @@ namespace chat_ns
 
     private:
         Registry::ptr _registry_client;
+        LoadReportOptions _load_report_options;
 
         std::shared_ptr<elasticlient::Client> _es_client;
+        WorkerPool::ptr _es_pool;
+        MysqlDataSource::ptr _mysql_source;
+        InsertBatcherOptions _user_batch_options;
         std::shared_ptr<sw::redis::Redis> _redis_client;
         std::string _file_service_name;
         ServiceManager::ptr _mm_channels;